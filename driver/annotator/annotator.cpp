@@ -1,17 +1,24 @@
 #include "annotator.h"
 
 #include "../detect/detect.h"
+#include "../document/json_reader.h"
+#include "../io/mapped_file.h"
+#include "../model/model_registry.h"
 #include "../embedder/impl/ft_embedder.h"
 #include "../nasty/nasty.h"
 #include "../utils.h"
 
-#include <boost/algorithm/string/join.hpp>
 #include <tinyxml2/tinyxml2.h>
 
+#include <deque>
 #include <optional>
+#include <string_view>
 
 namespace {
 
+constexpr std::size_t ANNOTATION_BATCH_SIZE = 64;
+constexpr std::size_t JSONL_CHUNK_SIZE = 256 * 1024;
+
 static std::unique_ptr<IEmbedder>
 EmbedderFromConfig(const postly::TEmbedderConfig& config) {
     if (config.type() == postly::ET_FASTTEXT) {
@@ -31,10 +38,10 @@ TAnnotator::TAnnotator(const std::string& configPath,
         , Mode(mode) {
     ParseConfig(configPath, Config);
     SaveNotNews |= Config.save_not_news();
-    SaveTexts |= (Config.save_texts() || (mode == "json"));
+    SaveTexts |= (Config.save_texts() || mode == "json" || mode == "annotations");
     ComputeNasty |= Config.compute_nasty();
 
-    LangDetector.loadModel(Config.lang_detect());
+    LangDetector = TModelRegistry::Shared().GetFastText(Config.lang_detect());
     LLOG("FastText language detector loaded", ELogLevel::LL_INFO);
 
     for (const std::string& language : langs) {
@@ -47,7 +54,7 @@ TAnnotator::TAnnotator(const std::string& configPath,
         if (Languages.find(lang) == Languages.end()) {
             continue;
         }
-        CategDetectors[lang].loadModel(config.path());
+        CategDetectors[lang] = TModelRegistry::Shared().GetFastText(config.path());
         LLOG("FastText:lang=" << ToString(lang) << " category model loaded [" << config.path() << "]", ELogLevel::LL_INFO);
     }
 
@@ -64,82 +71,242 @@ TAnnotator::TAnnotator(const std::string& configPath,
 std::vector<TDBDocument>
 TAnnotator::ProcessAll(const std::vector<std::string>& filesNames,
                        const postly::EInputFormat inputFormat) const {
-    TThreadPool threadPool;
     std::vector<TDBDocument> dbDocs;
-    std::vector<std::future<std::optional<TDBDocument>>> futures;
+    ProcessAll(filesNames, inputFormat, [&dbDocs](TDBDocument&& doc) {
+        dbDocs.push_back(std::move(doc));
+    });
+    dbDocs.shrink_to_fit();
+    return dbDocs;
+}
+
+void TAnnotator::ProcessAll(const std::vector<std::string>& filesNames,
+                            const postly::EInputFormat inputFormat,
+                            const TDocumentSink& sink) const {
+    // Records are read on this thread and annotated in batches on the shared pool.
+    // At most maxInFlight batches exist at once, results reach the sink in input order
+    TThreadPool& threadPool = TThreadPool::Shared();
+    const std::size_t maxInFlight = 2 * threadPool.GetThreadsCount();
+    // Mapped files must outlive the records referring to them
+    std::vector<TMappedFile> mappedFiles;
+    mappedFiles.reserve(filesNames.size());
+    std::deque<std::future<std::vector<TDBDocument>>> inFlight;
+
+    // On unwind the queued tasks still read the mapped files, they are waited for before unmapping
+    struct TInFlightGuard {
+        std::deque<std::future<std::vector<TDBDocument>>>& Futures;
+
+        ~TInFlightGuard() {
+            for (auto& future : Futures) {
+                if (future.valid()) {
+                    future.wait();
+                }
+            }
+        }
+    } inFlightGuard{inFlight};
+
+    const auto drain = [&inFlight, &sink](const std::size_t maxSize) {
+        while (inFlight.size() > maxSize) {
+            for (TDBDocument& doc : inFlight.front().get()) {
+                sink(std::move(doc));
+            }
+            inFlight.pop_front();
+        }
+    };
+    const auto submitTask = [&](auto task) {
+        inFlight.push_back(threadPool.enqueue(std::move(task)));
+        drain(maxInFlight);
+    };
+    // Records are parsed one by one and annotated together
+    const auto submit = [&](auto& batch, auto parse) {
+        if (batch.empty()) {
+            return;
+        }
+        submitTask([this, batch = std::move(batch), parse] {
+            std::vector<TDocument> documents;
+            for (const auto& record : batch) {
+                std::optional<TDocument> document = parse(record);
+                if (document) {
+                    documents.push_back(std::move(document.value()));
+                }
+            }
+            return ProcessSaved(documents);
+        });
+        batch.clear();
+    };
+    const auto parse = [](const std::string_view record) {
+        TDocument document;
+        return ReadJsonDocument(record, &document) ? std::make_optional(std::move(document)) : std::nullopt;
+    };
 
     if (inputFormat == postly::IF_HTML) {
-        dbDocs.reserve(filesNames.size());
-        futures.reserve(filesNames.size());
-        for (const auto& path : filesNames) {
-            using TFunc = std::optional<TDBDocument>(TAnnotator::*)(const std::string&) const;
-            futures.push_back(threadPool.enqueue<TFunc>(&TAnnotator::ProcessHTML, this, path));
+        const auto parse = [this](const std::string& path) {
+            return ParseHTML(path);
+        };
+        std::vector<std::string> batch;
+        for (const std::string& path : filesNames) {
+            batch.push_back(path);
+            if (batch.size() >= ANNOTATION_BATCH_SIZE) {
+                submit(batch, parse);
+            }
         }
+        submit(batch, parse);
     } else if (inputFormat == postly::IF_JSON) {
-        std::vector<nlohmann::json> parsedDocs;
+        // Only the bounds of the array items are found here, documents are parsed by the workers
+        std::vector<std::string_view> records;
+        std::vector<std::string_view> batch;
         for (const auto& path : filesNames) {
-            std::ifstream fileStream(path);
-            nlohmann::json json;
-            fileStream >> json;
-            for (const auto& obj : json) {
-                parsedDocs.push_back(obj);
+            const TMappedFile& file = mappedFiles.emplace_back(path);
+            ENSURE(file.IsOpen(), "Failed to read " << path);
+            records.clear();
+            ENSURE(SplitJsonArray(file.GetView(), &records), "Malformed json array in " << path);
+            for (const std::string_view record : records) {
+                batch.push_back(record);
+                if (batch.size() >= ANNOTATION_BATCH_SIZE) {
+                    submit(batch, parse);
+                }
             }
         }
-        parsedDocs.shrink_to_fit();
-        dbDocs.reserve(parsedDocs.size());
-        futures.reserve(parsedDocs.size());
-        for (const nlohmann::json& parsedDoc : parsedDocs) {
-            futures.push_back(threadPool.enqueue(&TAnnotator::ProcessJson, this, parsedDoc));
-        }
+        submit(batch, parse);
     } else if (inputFormat == postly::IF_JSONL) {
-        std::vector<TDocument> parsedDocs;
+        // Files are cut into newline aligned chunks, lines are parsed by the workers
         for (const auto& path: filesNames) {
-            std::ifstream fileStream(path);
-            std::string record;
-            while (std::getline(fileStream, record)) {
-                parsedDocs.emplace_back(nlohmann::json::parse(record));
+            const TMappedFile& file = mappedFiles.emplace_back(path);
+            ENSURE(file.IsOpen(), "Failed to read " << path);
+
+            std::string_view data = file.GetView();
+            while (!data.empty()) {
+                const std::size_t newline = data.find('\n', std::min(JSONL_CHUNK_SIZE, data.size()) - 1);
+                const std::string_view chunk =
+                    data.substr(0, newline == std::string_view::npos ? data.size() : newline + 1);
+                data.remove_prefix(chunk.size());
+
+                submitTask([this, chunk, parse] {
+                    std::vector<TDBDocument> docs;
+                    std::vector<TDocument> documents;
+                    const auto annotate = [this, &docs, &documents] {
+                        for (TDBDocument& doc : ProcessSaved(documents)) {
+                            docs.push_back(std::move(doc));
+                        }
+                        documents.clear();
+                    };
+                    std::string_view lines = chunk;
+                    while (!lines.empty()) {
+                        const std::size_t end = std::min(lines.find('\n'), lines.size());
+                        const std::string_view line = lines.substr(0, end);
+                        lines.remove_prefix(std::min(end + 1, lines.size()));
+                        if (line.find_first_not_of(" \t\r") == std::string_view::npos) {
+                            continue;
+                        }
+                        std::optional<TDocument> document = parse(line);
+                        if (document) {
+                            documents.push_back(std::move(document.value()));
+                        }
+                        if (documents.size() >= ANNOTATION_BATCH_SIZE) {
+                            annotate();
+                        }
+                    }
+                    annotate();
+                    return docs;
+                });
             }
         }
-        parsedDocs.shrink_to_fit();
-        dbDocs.reserve(parsedDocs.size());
-        futures.reserve(parsedDocs.size());
-        for (const TDocument& parsedDoc: parsedDocs) {
-            futures.push_back(threadPool.enqueue(&TAnnotator::ProcessDocument, this, parsedDoc));
-        }
     } else {
         ENSURE(false, "Inappropriate input format, got " << ToString(inputFormat));
     }
 
-    for (auto& futureDoc : futures) {
-        std::optional<TDBDocument> doc = futureDoc.get();
-        if (!doc) {
-            continue;
+    drain(0);
+}
+
+bool TAnnotator::IsSaved(const TDBDocument& doc) const {
+    if (Languages.find(doc.Language) == Languages.end()) {
+        return false;
+    }
+    if (!doc.IsFullyIndexed()) {
+        return false;
+    }
+    return doc.IsNews() || SaveNotNews;
+}
+
+std::vector<TDBDocument> TAnnotator::ProcessSaved(const std::vector<TDocument>& documents) const {
+    std::vector<const TDocument*> pointers;
+    pointers.reserve(documents.size());
+    for (const TDocument& document : documents) {
+        pointers.push_back(&document);
+    }
+
+    std::vector<TDBDocument> docs;
+    for (std::optional<TDBDocument>& doc : ProcessDocuments(pointers)) {
+        if (doc && IsSaved(*doc)) {
+            docs.push_back(std::move(doc.value()));
         }
-        if (Languages.find(doc->Language) == Languages.end()) {
-            continue;
+    }
+    return docs;
+}
+
+std::optional<TDBDocument>
+TAnnotator::ProcessDocument(const TDocument& doc) const {
+    return std::move(ProcessDocuments({&doc}).front());
+}
+
+std::vector<std::optional<TDBDocument>>
+TAnnotator::ProcessDocuments(const std::vector<const TDocument*>& documents) const {
+    std::vector<std::optional<TDBDocument>> dbDocs(documents.size());
+    std::vector<std::optional<TTokenizedText>> tokenized(documents.size());
+    for (std::size_t i = 0; i < documents.size(); ++i) {
+        dbDocs[i] = PrepareDocument(*documents[i]);
+        if (dbDocs[i] && Mode != "languages") {
+            tokenized[i].emplace(Tokenize(documents[i]->Title), Tokenize(documents[i]->Text));
         }
-        if (!doc->IsFullyIndexed()) {
+    }
+
+    for (const auto& [language, detector] : CategDetectors) {
+        std::vector<std::size_t> indices;
+        std::vector<TTokenSpan> titles;
+        for (std::size_t i = 0; i < documents.size(); ++i) {
+            if (tokenized[i] && dbDocs[i]->Language == language) {
+                indices.push_back(i);
+                titles.push_back(tokenized[i]->GetTitle());
+            }
+        }
+        if (indices.empty()) {
             continue;
         }
-        if (!doc->IsNews() && !SaveNotNews) {
+        const std::vector<postly::ECategory> categories =
+            DetectCategories(*detector, GetWordIds(*detector, titles));
+        for (std::size_t k = 0; k < indices.size(); ++k) {
+            dbDocs[indices[k]]->Category = categories[k];
+        }
+    }
+
+    for (std::size_t i = 0; i < documents.size(); ++i) {
+        if (!tokenized[i]) {
             continue;
         }
+        TDBDocument& dbDoc = dbDocs[i].value();
+        for (const auto& [embedInfo, embedder] : Embedders) {
+            const auto& [lang, embedKey] = embedInfo;
+            if (lang != dbDoc.Language) {
+                continue;
+            }
+            const TDBDocument::TEmbedding docEmbed =
+                embedder->CalcEmbedding(*tokenized[i]);
+            dbDoc.Embeddings.emplace(embedKey, std::move(docEmbed));
+        }
 
-        dbDocs.push_back(std::move(doc.value()));
+        if (ComputeNasty) {
+            dbDoc.IsNasty = IsNasty(dbDoc);
+        }
     }
 
-    futures.clear();
-    dbDocs.shrink_to_fit();
     return dbDocs;
 }
 
-std::optional<TDBDocument>
-TAnnotator::ProcessDocument(const TDocument& doc) const {
+std::optional<TDBDocument> TAnnotator::PrepareDocument(const TDocument& doc) const {
     TDBDocument dbDoc;
     if (doc.Language.has_value()) {
         dbDoc.Language = doc.Language.value();
     } else {
-        dbDoc.Language = DetectLanguage(LangDetector, doc);
+        dbDoc.Language = DetectLanguage(*LangDetector, doc);
     }
     dbDoc.Url = doc.Url;
     dbDoc.Host = GetHostFromUrl(dbDoc.Url);
@@ -164,29 +331,6 @@ TAnnotator::ProcessDocument(const TDocument& doc) const {
         return std::nullopt;
     }
 
-    const std::string title = Tokenize(doc.Title);
-    const std::string text = Tokenize(doc.Text);
-
-    auto detectorIt = CategDetectors.find(dbDoc.Language);
-    if (detectorIt != CategDetectors.end()) {
-        const auto& detector = detectorIt->second;
-        dbDoc.Category = DetectCategory(detector, title);
-    }
-
-    for (const auto& [embedInfo, embedder] : Embedders) {
-        const auto& [lang, embedKey] = embedInfo;
-        if (lang != dbDoc.Language) {
-            continue;
-        }
-        const TDBDocument::TEmbedding docEmbed =
-            embedder->CalcEmbedding(title, text);
-        dbDoc.Embeddings.emplace(embedKey, std::move(docEmbed));
-    }
-
-    if (ComputeNasty) {
-        dbDoc.IsNasty = IsNasty(dbDoc);
-    }
-
     return dbDoc;
 }
 
@@ -201,9 +345,9 @@ std::optional<TDBDocument> TAnnotator::ProcessHTML(const tinyxml2::XMLDocument&
     return doc.has_value() ? ProcessDocument(*doc) : std::nullopt;
 }
 
-std::optional<TDBDocument> TAnnotator::ProcessJson(const nlohmann::json& json) const {
-    std::optional<TDocument> doc = ParseJson(json);
-    return doc.has_value() ? ProcessDocument(*doc) : std::nullopt;
+std::optional<TDBDocument> TAnnotator::ProcessJson(const std::string_view json) const {
+    TDocument doc;
+    return ReadJsonDocument(json, &doc) ? ProcessDocument(doc) : std::nullopt;
 }
 
 std::optional<TDocument> TAnnotator::ParseHTML(const std::string& path) const {
@@ -227,20 +371,9 @@ std::optional<TDocument> TAnnotator::ParseHTML(const tinyxml2::XMLDocument& html
     return doc;
 }
 
-std::optional<TDocument> TAnnotator::ParseJson(const nlohmann::json& json) const {
-    TDocument doc;
-    try {
-        doc.FromJson(json);
-    } catch (...) {
-        return std::nullopt;
-    }
-    return doc;
-}
-
-std::string TAnnotator::Tokenize(const std::string &text) const
+std::vector<std::string> TAnnotator::Tokenize(const std::string &text) const
 {
     std::vector<std::string> tokens;
     Tokenizer.tokenize(text, tokens);
-
-    return boost::join(tokens, " ");
+    return tokens;
 }
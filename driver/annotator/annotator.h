@@ -7,8 +7,10 @@
 #include "../embedder/embedder.h"
 #include "../thread_pool/thread_pool.h"
 
+#include <functional>
 #include <memory>
 #include <optional>
+#include <string_view>
 #include <unordered_set>
 #include <unordered_map>
 #include <vector>
@@ -27,7 +29,7 @@ class FastText;
 }  // namespace fasttext
 
 using TFTCategDetectors =
-    std::unordered_map<postly::ELanguage, fasttext::FastText>;
+    std::unordered_map<postly::ELanguage, std::shared_ptr<const fasttext::FastText>>;
 
 class TAnnotator {
 public:
@@ -36,24 +38,36 @@ public:
         const std::vector<std::string>& langs,
         const std::string& mode = "top");
 
+    using TDocumentSink = std::function<void(TDBDocument&&)>;
+
     std::vector<TDBDocument> ProcessAll(
         const std::vector<std::string>& filesNames,
         const postly::EInputFormat inputFormat) const;
+    // Streams saved documents to the sink in input order, memory does not grow with the input
+    void ProcessAll(
+        const std::vector<std::string>& filesNames,
+        const postly::EInputFormat inputFormat,
+        const TDocumentSink& sink) const;
 
     std::optional<TDBDocument> ProcessHTML(const std::string& path) const;
     std::optional<TDBDocument> ProcessHTML(
         const tinyxml2::XMLDocument& html, const std::string& filename) const;
-    std::optional<TDBDocument> ProcessJson(const nlohmann::json& json) const;
+    std::optional<TDBDocument> ProcessJson(std::string_view json) const;
+    std::optional<TDBDocument> ProcessDocument(const TDocument& document) const;
+    // Category models are called once per language for the whole batch
+    std::vector<std::optional<TDBDocument>> ProcessDocuments(
+        const std::vector<const TDocument*>& documents) const;
 
 private:
-    std::optional<TDBDocument> ProcessDocument(const TDocument& document) const;
+    bool IsSaved(const TDBDocument& doc) const;
+    std::vector<TDBDocument> ProcessSaved(const std::vector<TDocument>& documents) const;
+    std::optional<TDBDocument> PrepareDocument(const TDocument& doc) const;
 
     std::optional<TDocument> ParseHTML(const std::string& path) const;
     std::optional<TDocument> ParseHTML(
         const tinyxml2::XMLDocument& html, const std::string& filename) const;
-    std::optional<TDocument> ParseJson(const nlohmann::json& json) const;
 
-    std::string Tokenize(const std::string& text) const;
+    std::vector<std::string> Tokenize(const std::string& text) const;
 
 private:
     postly::TAnnotatorConfig Config;
@@ -61,7 +75,7 @@ private:
     std::unordered_set<postly::ELanguage> Languages;
     onmt::Tokenizer Tokenizer;
 
-    fasttext::FastText LangDetector;
+    std::shared_ptr<const fasttext::FastText> LangDetector;
     TFTCategDetectors CategDetectors;
     std::map<std::pair<postly::ELanguage, postly::EEmbeddingKey>, std::unique_ptr<IEmbedder>> Embedders;
 
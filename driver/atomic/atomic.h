@@ -1,20 +1,169 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <vector>
 
+// Publishes immutable states to many readers. Every thread caches the last
+// state it has read, so reads of an unchanged state only load the shared
+// generation counter and never touch reference counts. Set releases cached
+// states that no reference of their thread uses, a state in use is released
+// by the next read or Set after its references are gone
 template<typename T>
 class TAtomic {
+private:
+    struct TLocal {
+        std::uint64_t Id = 0;
+        std::uint64_t Generation = std::numeric_limits<std::uint64_t>::max();
+        std::shared_ptr<T> State;
+        // Live references of the owner thread, written by the owner thread only
+        std::atomic<std::size_t> Readers = 0;
+        // Set when the TAtomic is destroyed, the owner thread drops the slot on its next read
+        std::atomic<bool> IsExpired = false;
+    };
+
 public:
-    TAtomic() = default;
+    // A read of the calling thread's cached state, keep it for a single request
+    class TLocalRef {
+    public:
+        TLocalRef(TLocalRef&& other) noexcept
+            : Slot(other.Slot)
+            , Owned(std::move(other.Owned))
+        {
+            other.Slot = nullptr;
+        }
+        TLocalRef(const TLocalRef&) = delete;
+        TLocalRef& operator=(const TLocalRef&) = delete;
+        TLocalRef& operator=(TLocalRef&&) = delete;
+
+        ~TLocalRef() {
+            if (Slot) {
+                Slot->Readers.store(Slot->Readers.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+            }
+        }
+
+        const std::shared_ptr<T>& Share() const { return Slot ? Slot->State : Owned; }
+        T* get() const { return Share().get(); }
+        T& operator*() const { return *get(); }
+        T* operator->() const { return get(); }
+        explicit operator bool() const { return get() != nullptr; }
+
+    private:
+        friend class TAtomic;
+
+        explicit TLocalRef(TLocal* slot)
+            : Slot(slot)
+        {
+        }
+        explicit TLocalRef(std::shared_ptr<T> owned)
+            : Owned(std::move(owned))
+        {
+        }
+
+    private:
+        TLocal* Slot = nullptr;
+        std::shared_ptr<T> Owned;
+    };
+
+    TAtomic()
+        : Id(NextId.fetch_add(1, std::memory_order_relaxed))
+    {
+    }
+
+    ~TAtomic() {
+        std::lock_guard<std::mutex> lock(Mutex);
+        for (const std::weak_ptr<TLocal>& weakSlot : Slots) {
+            if (const std::shared_ptr<TLocal> slot = weakSlot.lock()) {
+                slot->State.reset();
+                slot->IsExpired.store(true, std::memory_order_release);
+            }
+        }
+    }
+
+    TAtomic(const TAtomic&) = delete;
+    TAtomic& operator=(const TAtomic&) = delete;
+
+    TLocalRef GetLocal() const {
+        TLocal& local = GetLocalSlot();
+        const std::size_t readers = local.Readers.load(std::memory_order_relaxed);
+        // Pairs with the check in Set: either Set sees the reader or the reader sees the new generation
+        local.Readers.store(readers + 1, std::memory_order_seq_cst);
+        if (local.Generation != Generation.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(Mutex);
+            if (readers) {
+                // An outer reference of this thread still uses the cached state
+                local.Readers.store(readers, std::memory_order_release);
+                return TLocalRef(State);
+            }
+            local.State = State;
+            local.Generation = Generation.load(std::memory_order_relaxed);
+        }
+        return TLocalRef(&local);
+    }
 
     std::shared_ptr<T> Get() const {
-        return std::atomic_load(&State);
+        return GetLocal().Share();
+    }
+
+    std::uint64_t GetGeneration() const {
+        return Generation.load(std::memory_order_acquire);
     }
 
     void Set(std::shared_ptr<T> newState) {
-        std::atomic_store(&State, newState);
+        std::vector<std::shared_ptr<T>> released;
+        {
+            std::lock_guard<std::mutex> lock(Mutex);
+            State.swap(newState);
+            Generation.fetch_add(1, std::memory_order_seq_cst);
+            released.reserve(Slots.size());
+            std::size_t alive = 0;
+            for (std::weak_ptr<TLocal>& weakSlot : Slots) {
+                const std::shared_ptr<TLocal> slot = weakSlot.lock();
+                if (!slot) {
+                    continue;
+                }
+                if (!slot->Readers.load(std::memory_order_seq_cst)) {
+                    released.push_back(std::move(slot->State));
+                }
+                Slots[alive++] = std::move(weakSlot);
+            }
+            Slots.resize(alive);
+        }
+        // Previous states are released outside of the lock
+        newState.reset();
+        released.clear();
     }
 
 private:
+    TLocal& GetLocalSlot() const {
+        thread_local std::vector<std::shared_ptr<TLocal>> slots;
+        for (std::size_t i = 0; i < slots.size(); ++i) {
+            if (slots[i]->Id == Id) {
+                return *slots[i];
+            }
+            if (slots[i]->IsExpired.load(std::memory_order_acquire)) {
+                slots[i].swap(slots.back());
+                slots.pop_back();
+                --i;
+            }
+        }
+        const std::shared_ptr<TLocal>& slot = slots.emplace_back(std::make_shared<TLocal>());
+        slot->Id = Id;
+        std::lock_guard<std::mutex> lock(Mutex);
+        Slots.push_back(slot);
+        return *slot;
+    }
+
+private:
+    inline static std::atomic<std::uint64_t> NextId = 0;
+
+    const std::uint64_t Id;
+    std::atomic<std::uint64_t> Generation = 0;
+    mutable std::mutex Mutex;
     std::shared_ptr<T> State;
+    // Cached states of all reader threads, slots of finished threads expire
+    mutable std::vector<std::weak_ptr<TLocal>> Slots;
 };
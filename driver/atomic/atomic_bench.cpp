@@ -0,0 +1,80 @@
+// Read throughput of TAtomic against std::atomic_load on a shared_ptr.
+// Usage: atomic_bench [max threads] [milliseconds per run]
+
+#include "atomic.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct TState {
+    std::uint64_t Value = 0;
+};
+
+template <typename TRead>
+double MeasureReads(const std::size_t threadsCount, const std::chrono::milliseconds duration, TRead&& read) {
+    std::atomic<bool> isStarted = false;
+    std::atomic<bool> isDone = false;
+    std::vector<std::uint64_t> reads(threadsCount, 0);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < threadsCount; ++i) {
+        threads.emplace_back([&, i] {
+            while (!isStarted.load(std::memory_order_acquire)) {
+            }
+            std::uint64_t count = 0;
+            std::uint64_t sum = 0;
+            while (!isDone.load(std::memory_order_relaxed)) {
+                sum += read();
+                ++count;
+            }
+            reads[i] = count + (sum == 1 ? 1 : 0);
+        });
+    }
+
+    isStarted.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(duration);
+    isDone.store(true, std::memory_order_relaxed);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    std::uint64_t total = 0;
+    for (const std::uint64_t count : reads) {
+        total += count;
+    }
+    return total / std::chrono::duration<double>(duration).count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const std::size_t maxThreads = argc > 1 ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+    const std::chrono::milliseconds duration(argc > 2 ? std::atoi(argv[2]) : 500);
+
+    std::shared_ptr<TState> plain = std::make_shared<TState>();
+    TAtomic<TState> atomic;
+    atomic.Set(std::make_shared<TState>());
+
+    std::cout << "threads\tatomic_load\tTAtomic::Get\tTAtomic::GetLocal\t(million reads per second)" << std::endl;
+    for (std::size_t threadsCount = 1; threadsCount <= maxThreads; threadsCount *= 2) {
+        const double plainReads = MeasureReads(threadsCount, duration, [&plain] {
+            return std::atomic_load(&plain)->Value;
+        });
+        const double copyReads = MeasureReads(threadsCount, duration, [&atomic] {
+            return atomic.Get()->Value;
+        });
+        const double localReads = MeasureReads(threadsCount, duration, [&atomic] {
+            return atomic.GetLocal()->Value;
+        });
+        std::cout << threadsCount << std::fixed << std::setprecision(1)
+            << "\t" << plainReads / 1e6
+            << "\t" << copyReads / 1e6
+            << "\t" << localReads / 1e6 << std::endl;
+    }
+    return 0;
+}
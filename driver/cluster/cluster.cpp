@@ -13,10 +13,50 @@
 
 static constexpr std::size_t N_FEATURES = 120;
 
-void TCluster::AddDocument(const TDBDocument& doc) {
-    Documents.push_back(std::move(doc));
-    MaxTimestamp = std::max(
-        MaxTimestamp, static_cast<std::uint64_t>(Documents.back().FetchTime));
+TCluster TCluster::FromProto(const postly::TClusterProto& proto, TDocumentStore& store) {
+    TCluster cluster(proto.id(), store);
+    cluster.Category = proto.category();
+    cluster.BestTimestamp = proto.best_timestamp();
+    cluster.Importance = proto.importance();
+    cluster.Features.assign(proto.features().cbegin(), proto.features().cend());
+    cluster.DocWeights.assign(proto.doc_weights().cbegin(), proto.doc_weights().cend());
+    cluster.CountryShare.insert(proto.country_share().cbegin(), proto.country_share().cend());
+    cluster.WeightedCountryShare.insert(
+        proto.weighted_country_share().cbegin(), proto.weighted_country_share().cend());
+
+    cluster.Documents.reserve(proto.documents_size());
+    for (const auto& docProto : proto.documents()) {
+        cluster.AddDocument(store.Add(TDBDocument::FromProto(docProto)));
+    }
+    return cluster;
+}
+
+postly::TClusterProto TCluster::ToProto() const {
+    postly::TClusterProto proto;
+    proto.set_id(Id);
+    proto.set_category(Category);
+    proto.set_best_timestamp(BestTimestamp);
+    proto.set_importance(Importance);
+    *proto.mutable_features() = {Features.cbegin(), Features.cend()};
+    *proto.mutable_doc_weights() = {DocWeights.cbegin(), DocWeights.cend()};
+    proto.mutable_country_share()->insert(CountryShare.cbegin(), CountryShare.cend());
+    proto.mutable_weighted_country_share()->insert(WeightedCountryShare.cbegin(), WeightedCountryShare.cend());
+
+    for (const TDocId doc : Documents) {
+        *proto.add_documents() = Store->Get(doc).ToProto();
+    }
+    return proto;
+}
+
+void TCluster::AddDocument(const TDocId doc) {
+    Documents.push_back(doc);
+    MaxTimestamp = std::max(MaxTimestamp, Store->GetFetchTime(doc));
+}
+
+void TCluster::Rebind(const TDocumentStore& store, TDocIds&& documents) {
+    assert(documents.size() == Documents.size());
+    Store = &store;
+    Documents = std::move(documents);
 }
 
 std::uint64_t TCluster::GetTimestamp(const float percentile) const {
@@ -26,8 +66,8 @@ std::uint64_t TCluster::GetTimestamp(const float percentile) const {
     std::vector<std::uint64_t> clusterTs;
     clusterTs.reserve(nDocs);
 
-    for (const auto& doc : Documents) {
-        clusterTs.push_back(doc.FetchTime);
+    for (const TDocId doc : Documents) {
+        clusterTs.push_back(Store->GetFetchTime(doc));
     }
     std::size_t idx = static_cast<std::size_t>(std::floor(percentile * (clusterTs.size() - 1)));
     boost::range::nth_element(clusterTs, clusterTs.begin() + idx);
@@ -39,13 +79,14 @@ void TCluster::Summarize(const TRating& agencyRating) {
 
     const auto embeddingKey =
         (GetLanguage() == postly::NL_RU ? postly::EK_FASTTEXT_TITLE : postly::EK_FASTTEXT_CLASSIC);
-    const std::size_t embeddingSize = Documents.back().Embeddings.at(embeddingKey).size();
+    const std::size_t embeddingSize = Store->Get(Documents.back()).GetEmbeddingSize(embeddingKey);
 
-    Eigen::MatrixXf points(GetSize(), embeddingSize);
+    Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> points(GetSize(), embeddingSize);
     for (std::size_t i = 0; i < GetSize(); i++) {
-        auto embedding = Documents[i].Embeddings.at(embeddingKey);
-        Eigen::Map<Eigen::VectorXf, Eigen::Unaligned> eigenVector(embedding.data(), embedding.size());
-        points.row(i) = eigenVector / eigenVector.norm();
+        const TDBDocument& doc = Store->Get(Documents[i]);
+        ENSURE(doc.GetEmbeddingSize(embeddingKey) == embeddingSize, "Bad embedding size in " << doc.Filename);
+        doc.CopyEmbedding(embeddingKey, points.row(i).data());
+        points.row(i) /= points.row(i).norm();
     }
     Eigen::MatrixXf docsCosine = points * points.transpose();
 
@@ -53,7 +94,7 @@ void TCluster::Summarize(const TRating& agencyRating) {
     weights.reserve(GetSize());
     std::uint64_t freshestTimestamp = GetMaxTimestamp();
     for (std::size_t i = 0; i < GetSize(); ++i) {
-        const TDBDocument& doc = Documents[i];
+        const TDBDocument& doc = Store->Get(Documents[i]);
         double docRelevance = docsCosine.row(i).mean();
         std::int64_t timeDiff =
             static_cast<std::int64_t>(doc.FetchTime) - static_cast<std::int64_t>(freshestTimestamp);
@@ -69,7 +110,7 @@ void TCluster::Summarize(const TRating& agencyRating) {
 }
 
 void TCluster::GetFeatures(const TAlexaRating& rating,
-                           const std::vector<TDBDocument>& docs) {
+                           const TDocIds& docs) {
     Features.reserve(N_FEATURES);
     const std::vector<std::string> codes = {"US", "GB", "IN", "RU", "CA", "AU"};
     const std::vector<double> decays = {1800., 3600., 7200., 86400.};
@@ -103,7 +144,7 @@ void TCluster::GetFeatures(const TAlexaRating& rating,
 }
 
 TFeatures TCluster::GetImportance(const TAlexaRating& alexaRating,
-                                  const std::vector<TDBDocument>& docs,
+                                  const TDocIds& docs,
                                   const postly::ELanguage language,
                                   const ERatingType type,
                                   const double shift,
@@ -119,12 +160,12 @@ TFeatures TCluster::GetImportance(const TAlexaRating& alexaRating,
     }
 
     features.DocWeights.reserve(GetSize());
-    for (const auto& doc : Documents) {
+    for (const TDocId doc : Documents) {
+        const std::string& docHost = Store->GetHost(doc);
         const double agencyWeight =
-            alexaRating.ScoreUrl(doc.Host, language, type, shift);
+            alexaRating.ScoreUrl(docHost, language, type, shift);
         features.DocWeights.push_back(agencyWeight);
 
-        const std::string& docHost = doc.Host;;
         for (const std::string& code : codes) {
             double share = alexaRating.GetCountryShare(docHost, code);
             features.CountryShare[code] += share;
@@ -144,18 +185,17 @@ TFeatures TCluster::GetImportance(const TAlexaRating& alexaRating,
     }
 
     for (std::size_t i = 0; i < docs.size(); ++i) {
-        const TDBDocument& startDoc = docs[i];
-        int32_t startTime = startDoc.FetchTime;
+        const std::uint64_t startFetchTime = Store->GetFetchTime(docs[i]);
+        int32_t startTime = startFetchTime;
         double rank = 0.;
-        std::set<std::string> seenHosts;
+        std::set<std::uint32_t> seenHosts;
 
         for (std::size_t j = i; j < docs.size(); ++j) {
-            const TDBDocument& doc = docs[j];
-            const std::string& docHost = doc.Host;
-            if (seenHosts.insert(docHost).second) {
-                double agencyWeight = alexaRating.ScoreUrl(docHost, language, type, shift);
+            const TDocId doc = docs[j];
+            if (seenHosts.insert(Store->GetHostId(doc)).second) {
+                double agencyWeight = alexaRating.ScoreUrl(Store->GetHost(doc), language, type, shift);
                 double docTimestampRemapped =
-                    static_cast<double>(startTime - static_cast<int32_t>(doc.FetchTime)) / decay;
+                    static_cast<double>(startTime - static_cast<int32_t>(Store->GetFetchTime(doc))) / decay;
                 double timeMultiplier = Sigmoid<double>(std::max(docTimestampRemapped, -15.));
                 double score = agencyWeight * timeMultiplier;
                 rank += score;
@@ -163,7 +203,7 @@ TFeatures TCluster::GetImportance(const TAlexaRating& alexaRating,
         }
         if (rank > features.Importance) {
             features.Importance = rank;
-            features.BestTimestamp = startDoc.FetchTime;
+            features.BestTimestamp = startFetchTime;
         }
     }
 
@@ -171,13 +211,13 @@ TFeatures TCluster::GetImportance(const TAlexaRating& alexaRating,
 }
 
 void TCluster::GetImportance(const TAlexaRating& alexaRating) {
-    std::vector<TDBDocument> docs = GetDocuments();
+    TDocIds docs = Documents;
 
-    std::stable_sort(docs.begin(), docs.end(), [](const TDBDocument& p1, const TDBDocument& p2) {
-        if (p1.FetchTime != p2.FetchTime) {
-            return p1.FetchTime < p2.FetchTime;
+    std::stable_sort(docs.begin(), docs.end(), [this](const TDocId p1, const TDocId p2) {
+        if (Store->GetFetchTime(p1) != Store->GetFetchTime(p2)) {
+            return Store->GetFetchTime(p1) < Store->GetFetchTime(p2);
         }
-        return p1.Url < p2.Url;
+        return Store->Get(p1).Url < Store->Get(p2).Url;
     });
 
     GetFeatures(alexaRating, docs);
@@ -192,7 +232,7 @@ void TCluster::GetImportance(const TAlexaRating& alexaRating) {
 void TCluster::GetCategory() {
     std::vector<std::size_t> categoryCount(postly::ECategory_ARRAYSIZE);
 
-    for (const TDBDocument& doc : Documents) {
+    for (const TDBDocument& doc : GetDocuments()) {
         postly::ECategory categ = doc.Category;
         assert(doc.IsNews());
         categoryCount[static_cast<size_t>(categ)] += 1;
@@ -203,26 +243,25 @@ void TCluster::GetCategory() {
 }
 
 void TCluster::SortByWeights(const std::vector<double>& weights) {
-    std::vector<std::pair<TDBDocument, double>> weightedDocs;
+    std::vector<std::pair<TDocId, double>> weightedDocs;
     weightedDocs.reserve(GetSize());
 
     for (size_t i = 0; i < GetSize(); i++) {
-        weightedDocs.emplace_back(std::move(Documents[i]), weights[i]);
+        weightedDocs.emplace_back(Documents[i], weights[i]);
     }
-    Documents.clear();
 
-    std::stable_sort(weightedDocs.begin(), weightedDocs.end(), [](
-        const std::pair<TDBDocument, double>& a,
-        const std::pair<TDBDocument, double>& b)
+    std::stable_sort(weightedDocs.begin(), weightedDocs.end(), [this](
+        const std::pair<TDocId, double>& a,
+        const std::pair<TDocId, double>& b)
     {
         if (std::abs(a.second - b.second) < 0.000001) {
-            return a.first.Title < b.first.Title;
+            return Store->GetTitle(a.first) < Store->GetTitle(b.first);
         }
         return a.second > b.second;
     });
 
-    for (const auto& [doc, _] : weightedDocs) {
-        AddDocument(doc);
+    for (size_t i = 0; i < GetSize(); i++) {
+        Documents[i] = weightedDocs[i].first;
     }
 }
 
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "driver/index.pb.h"
+
 #include "../document/impl/db_document.h"
+#include "../document/impl/document_store.h"
 #include "../rating/rating.h"
 #include "../utils.h"
 
@@ -25,24 +28,31 @@ private:
     std::map<std::string, double> CountryShare;
     std::map<std::string, double> WeightedCountryShare;
 
-    std::vector<TDBDocument> Documents;
+    const TDocumentStore* Store;
+    TDocIds Documents;
 
 public:
-    explicit TCluster(const std::uint64_t id)
+    TCluster(const std::uint64_t id, const TDocumentStore& store)
         : Id(id)
+        , Store(&store)
         {
         }
 
-    void AddDocument(const TDBDocument& document);
+    static TCluster FromProto(const postly::TClusterProto& proto, TDocumentStore& store);
+    postly::TClusterProto ToProto() const;
+
+    void AddDocument(const TDocId document);
+    // Moves the cluster to another store holding the same documents under new ids
+    void Rebind(const TDocumentStore& store, TDocIds&& documents);
     void Summarize(const TRating& agencyRating);
 
     void GetFeatures(
         const TAlexaRating& alexaRating,
-        const std::vector<TDBDocument>& docs);
+        const TDocIds& docs);
 
     TFeatures GetImportance(
         const TAlexaRating& alexaRating,
-        const std::vector<TDBDocument>& docs,
+        const TDocIds& docs,
         const postly::ELanguage language,
         const ERatingType type,
         const double shift,
@@ -56,12 +66,15 @@ public:
     bool operator<(const TCluster& other) const;
     bool operator<(const std::uint64_t timestamp) const;
 
+    std::uint64_t GetId() const { return Id; }
     postly::ECategory GetCategory() const { return Category; }
     std::uint64_t GetMaxTimestamp() const { return MaxTimestamp; }
     std::size_t GetSize() const { return Documents.size(); }
-    const std::vector<TDBDocument>& GetDocuments() const { return Documents; }
-    std::string GetTitle() const { return Documents.front().Title; }
-    postly::ELanguage GetLanguage() const { return Documents.front().Language; }
+    TDocumentRange GetDocuments() const { return TDocumentRange(*Store, Documents); }
+    const TDocIds& GetDocIds() const { return Documents; }
+    const TDocumentStore& GetStore() const { return *Store; }
+    std::string GetTitle() const { return std::string(Store->GetTitle(Documents.front())); }
+    postly::ELanguage GetLanguage() const { return Store->Get(Documents.front()).Language; }
     double GetImportance() const { return Importance; }
     std::uint64_t GetBestTimestamp() const { return BestTimestamp; }
     const std::vector<double>& GetDocWeights() const { return DocWeights; }
@@ -2,20 +2,52 @@
 #include "impl/single_linkage.h"
 #include "../utils.h"
 
+#include <algorithm>
+#include <future>
 #include <iostream>
 
 namespace {
 
-std::uint64_t GetIterTimestamp(const std::vector<TDBDocument>& docs, double percentile) {
+std::uint64_t GetIterTimestamp(const std::vector<TDocumentStore::TDocumentPtr>& docs, double percentile) {
     if (docs.empty()) {
         return 0;
     }
-    assert(std::is_sorted(docs.begin(), docs.end(), [](const TDBDocument& d1, const TDBDocument& d2) {
-        return d1.FetchTime < d2.FetchTime;
-    }));
+    assert(std::is_sorted(docs.begin(), docs.end(),
+        [](const TDocumentStore::TDocumentPtr& d1, const TDocumentStore::TDocumentPtr& d2) {
+            return d1->FetchTime < d2->FetchTime;
+        }
+    ));
 
     std::size_t index = std::floor(percentile * docs.size());
-    return docs[index].FetchTime;
+    return docs[index]->FetchTime;
+}
+
+bool IsEarlier(const TDBDocument& d1, const TDBDocument& d2) {
+    if (d1.FetchTime == d2.FetchTime) {
+        if (d1.Filename.empty() && d2.Filename.empty()) {
+            return d1.Title.length() < d2.Title.length();
+        }
+        return d1.Filename < d2.Filename;
+    }
+    return d1.FetchTime < d2.FetchTime;
+}
+
+void SortDocuments(std::vector<TDocumentStore::TDocumentPtr>& docs) {
+    const auto isEarlier = [](const TDocumentStore::TDocumentPtr& d1, const TDocumentStore::TDocumentPtr& d2) {
+        return IsEarlier(*d1, *d2);
+    };
+    // Windowed storage scans already return documents in this order
+    if (!std::is_sorted(docs.begin(), docs.end(), isEarlier)) {
+        std::stable_sort(docs.begin(), docs.end(), isEarlier);
+    }
+}
+
+void SortDocuments(const TDocumentStore& store, TDocIds& docs) {
+    std::stable_sort(docs.begin(), docs.end(),
+        [&store](const TDocId d1, const TDocId d2) {
+            return IsEarlier(store.Get(d1), store.Get(d2));
+        }
+    );
 }
 
 }  // namespace
@@ -28,44 +60,80 @@ TClusterer::TClusterer(const std::string& configPath) {
 }
 
 TIndex TClusterer::Cluster(std::vector<TDBDocument>&& docs) const {
-    std::stable_sort(docs.begin(), docs.end(),
-        [](const TDBDocument& d1, const TDBDocument& d2) {
-            if (d1.FetchTime == d2.FetchTime) {
-                if (d1.Filename.empty() && d2.Filename.empty()) {
-                    return d1.Title.length() < d2.Title.length();
-                }
-                return d1.Filename < d2.Filename;
-            }
-            return d1.FetchTime < d2.FetchTime;
-        }
-    );
+    std::vector<TDocumentStore::TDocumentPtr> docPtrs;
+    docPtrs.reserve(docs.size());
+    for (TDBDocument& doc : docs) {
+        docPtrs.push_back(std::make_shared<const TDBDocument>(std::move(doc)));
+    }
+    docs.clear();
+    docs.shrink_to_fit();
+    return Cluster(std::move(docPtrs));
+}
+
+TIndex TClusterer::Cluster(std::vector<TDocumentStore::TDocumentPtr>&& docs) const {
+    SortDocuments(docs);
 
     TIndex index;
     index.IterTimestamp = GetIterTimestamp(docs, Config.iter_timestamp_percentile());
-    index.MaxTimestamp = docs.empty() ? 0 : docs.back().FetchTime;
+    index.MaxTimestamp = docs.empty() ? 0 : docs.back()->FetchTime;
+    index.Store = std::make_shared<TDocumentStore>();
+    const TDocumentStore& store = *index.Store;
 
-    std::map<postly::ELanguage, std::vector<TDBDocument>> lang2Docs;
+    std::map<postly::ELanguage, TDocIds> lang2Docs;
+    index.Store->Reserve(docs.size());
     while (!docs.empty()) {
-        const TDBDocument& doc = docs.back();
-        if (Clusterings.find(doc.Language) != Clusterings.end()) {
-            lang2Docs[doc.Language].push_back(doc);
+        const postly::ELanguage language = docs.back()->Language;
+        if (Clusterings.find(language) != Clusterings.end()) {
+            lang2Docs[language].push_back(index.Store->Add(std::move(docs.back())));
         }
         docs.pop_back();
     }
     docs.shrink_to_fit();
-    docs.clear();
 
+    if (!Config.parallel_languages()) {
+        for (const auto& [language, clustering] : Clusterings) {
+            index.Clusters[language] = ClusterSorted(language, store, lang2Docs[language]);
+        }
+        return index;
+    }
+
+    std::vector<std::pair<postly::ELanguage, std::future<TClusters>>> langClusters;
     for (const auto& [language, clustering] : Clusterings) {
-        TClusters langClusters = clustering->Cluster(lang2Docs[language]);
-        std::stable_sort(
-            langClusters.begin(),
-            langClusters.end(),
-            [](const TCluster& a, const TCluster& b) {
-                return a.GetMaxTimestamp() < b.GetMaxTimestamp();
-            }
-        );
-        index.Clusters[language] = std::move(langClusters);
+        const TDocIds& langDocs = lang2Docs[language];
+        langClusters.emplace_back(language, std::async(std::launch::async, [this, language, &store, &langDocs] {
+            return ClusterSorted(language, store, langDocs);
+        }));
+    }
+    for (auto& [language, clusters] : langClusters) {
+        index.Clusters[language] = clusters.get();
     }
 
     return index;
 }
+
+TClusters TClusterer::ClusterLanguage(const postly::ELanguage language,
+                                      const TDocumentStore& store,
+                                      TDocIds&& docs) const {
+    SortDocuments(store, docs);
+    std::reverse(docs.begin(), docs.end());
+    return ClusterSorted(language, store, docs);
+}
+
+TClusters TClusterer::ClusterSorted(const postly::ELanguage language,
+                                    const TDocumentStore& store,
+                                    const TDocIds& docs) const {
+    const auto it = Clusterings.find(language);
+    if (it == Clusterings.end()) {
+        return {};
+    }
+
+    TClusters langClusters = it->second->Cluster(store, docs);
+    std::stable_sort(
+        langClusters.begin(),
+        langClusters.end(),
+        [](const TCluster& a, const TCluster& b) {
+            return a.GetMaxTimestamp() < b.GetMaxTimestamp();
+        }
+    );
+    return langClusters;
+}
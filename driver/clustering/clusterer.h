@@ -5,15 +5,21 @@
 #include "../cluster/cluster.h"
 #include "clustering.h"
 #include "../document/impl/db_document.h"
+#include "../ranker/ranker.h"
 
 #include <unordered_map>
 #include <vector>
 #include <memory>
 
 struct TIndex {
+    // Clusters refer to the documents of this store
+    std::shared_ptr<TDocumentStore> Store;
     std::unordered_map<postly::ELanguage, TClusters> Clusters;
+    std::unordered_map<postly::ELanguage, TRankedViews> RankedViews;
     std::uint64_t IterTimestamp = 0;
     std::uint64_t MaxTimestamp = 0;
+    // Increases with every index published by the server
+    std::uint64_t Generation = 0;
 };
 
 class TClusterer {
@@ -21,6 +27,19 @@ public:
     explicit TClusterer(const std::string& configPath);
 
     TIndex Cluster(std::vector<TDBDocument>&& docs) const;
+    TIndex Cluster(std::vector<TDocumentStore::TDocumentPtr>&& docs) const;
+    TClusters ClusterLanguage(
+        const postly::ELanguage language,
+        const TDocumentStore& store,
+        TDocIds&& docs) const;
+
+    float GetIterTimestampPercentile() const { return Config.iter_timestamp_percentile(); }
+
+private:
+    TClusters ClusterSorted(
+        const postly::ELanguage language,
+        const TDocumentStore& store,
+        const TDocIds& docs) const;
 
 private:
     postly::TClustererConfig Config;
@@ -2,11 +2,13 @@
 
 #include "../cluster/cluster.h"
 #include "../document/impl/db_document.h"
+#include "../document/impl/document_store.h"
 
 class IClustering {
 public:
     IClustering() = default;
     virtual ~IClustering() = default;
     virtual TClusters Cluster(
-        const std::vector<TDBDocument>& docs) const = 0;
+        const TDocumentStore& store,
+        const TDocIds& docs) const = 0;
 };
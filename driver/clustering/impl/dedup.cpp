@@ -0,0 +1,260 @@
+#include "dedup.h"
+
+#include "../../utils.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+namespace {
+
+static const std::size_t SHINGLE_SIZE = 3;
+// Shorter texts, e.g. titles of documents stored without text, are collapsed only when exactly equal
+static const std::size_t MIN_SIMHASH_SHINGLES = 16;
+static const std::uint64_t NEAR_DUPLICATES_MAX_TIME_DIFF = 24 * 3600;
+
+std::uint64_t MixHash(std::uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+std::uint64_t CombineHashes(const std::uint64_t lhs, const std::uint64_t rhs) {
+    return MixHash(lhs * 0x9e3779b97f4a7c15ULL + rhs);
+}
+
+// Lowercases latin and cyrillic letters and replaces ascii punctuation and spaces with single spaces
+void AppendNormalized(std::string_view text, std::string* out) {
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        const unsigned char c = text[i];
+        if (c < 0x80) {
+            if (std::isalnum(c)) {
+                out->push_back(static_cast<char>(std::tolower(c)));
+            } else if (!out->empty() && out->back() != ' ') {
+                out->push_back(' ');
+            }
+            continue;
+        }
+
+        const unsigned char next = i + 1 < text.size() ? text[i + 1] : 0;
+        if (c == 0xD0 && next >= 0x90 && next <= 0x9F) {
+            out->push_back(static_cast<char>(0xD0));
+            out->push_back(static_cast<char>(next + 0x20));
+            ++i;
+        } else if (c == 0xD0 && next >= 0xA0 && next <= 0xAF) {
+            out->push_back(static_cast<char>(0xD1));
+            out->push_back(static_cast<char>(next - 0x20));
+            ++i;
+        } else if (c == 0xD0 && next == 0x81) {
+            out->append("\xD1\x91");
+            ++i;
+        } else {
+            out->push_back(static_cast<char>(c));
+        }
+    }
+}
+
+void Normalize(const TDBDocument& document, std::string* out) {
+    out->clear();
+    AppendNormalized(document.Title, out);
+    out->push_back(' ');
+    AppendNormalized(document.Text, out);
+}
+
+std::vector<std::string_view> SplitWords(std::string_view text) {
+    std::vector<std::string_view> words;
+    std::size_t begin = 0;
+    while (begin < text.size()) {
+        std::size_t end = text.find(' ', begin);
+        if (end == std::string_view::npos) {
+            end = text.size();
+        }
+        if (end > begin) {
+            words.push_back(text.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+    return words;
+}
+
+bool CalcSimHash(const std::vector<std::string_view>& words, std::uint64_t* simHash) {
+    if (words.size() < SHINGLE_SIZE + MIN_SIMHASH_SHINGLES - 1) {
+        return false;
+    }
+
+    std::vector<std::uint64_t> wordHashes(words.size());
+    std::transform(words.begin(), words.end(), wordHashes.begin(), std::hash<std::string_view>());
+
+    int counts[64] = {};
+    for (std::size_t i = 0; i + SHINGLE_SIZE <= words.size(); ++i) {
+        std::uint64_t shingleHash = 0;
+        for (std::size_t j = 0; j < SHINGLE_SIZE; ++j) {
+            shingleHash = CombineHashes(shingleHash, wordHashes[i + j]);
+        }
+        for (std::size_t bit = 0; bit < 64; ++bit) {
+            counts[bit] += (shingleHash >> bit) & 1 ? 1 : -1;
+        }
+    }
+
+    *simHash = 0;
+    for (std::size_t bit = 0; bit < 64; ++bit) {
+        if (counts[bit] > 0) {
+            *simHash |= 1ULL << bit;
+        }
+    }
+    return true;
+}
+
+std::uint64_t CalcEmbeddingsHash(const TDBDocument& document, const postly::TClusteringConfig& config) {
+    std::uint64_t hash = 0;
+    std::vector<float> embedding;
+    for (const auto& embKeyWeight : config.embedding_keys_weights()) {
+        embedding.resize(document.GetEmbeddingSize(embKeyWeight.embedding_key()));
+        document.CopyEmbedding(embKeyWeight.embedding_key(), embedding.data());
+        const std::string_view bytes(
+            reinterpret_cast<const char*>(embedding.data()), embedding.size() * sizeof(float));
+        hash = CombineHashes(hash, std::hash<std::string_view>()(bytes));
+    }
+    return hash;
+}
+
+bool HasSameEmbeddings(const TDBDocument& lhs, const TDBDocument& rhs, const postly::TClusteringConfig& config) {
+    std::vector<float> lhsEmbedding;
+    std::vector<float> rhsEmbedding;
+    for (const auto& embKeyWeight : config.embedding_keys_weights()) {
+        const postly::EEmbeddingKey key = embKeyWeight.embedding_key();
+        lhsEmbedding.resize(lhs.GetEmbeddingSize(key));
+        rhsEmbedding.resize(rhs.GetEmbeddingSize(key));
+        lhs.CopyEmbedding(key, lhsEmbedding.data());
+        rhs.CopyEmbedding(key, rhsEmbedding.data());
+        if (lhsEmbedding != rhsEmbedding) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+TCollapsedDocs CollapseDuplicates(
+    const TDocumentStore& store,
+    const TDocIds& docs,
+    const postly::TClusteringConfig& config) {
+    const bool banSameHosts = config.ban_same_hosts();
+    const std::size_t maxDistance = config.simhash_max_distance();
+    ENSURE(maxDistance < 16, "simhash_max_distance is too large for SimHash bands");
+
+    TCollapsedDocs result;
+    result.Groups.reserve(docs.size());
+
+    const auto addGroup = [&](const std::size_t docIndex) {
+        result.Groups.push_back(result.Representatives.size());
+        result.Representatives.push_back(docs[docIndex]);
+        result.Weights.push_back(1);
+        result.SitesNames.emplace_back();
+        if (banSameHosts) {
+            result.SitesNames.back().insert(store.Get(docs[docIndex]).SiteName);
+        }
+        return result.Representatives.size() - 1;
+    };
+
+    if (!config.collapse_duplicates()) {
+        for (std::size_t i = 0; i < docs.size(); ++i) {
+            addGroup(i);
+        }
+        return result;
+    }
+
+    // Near duplicates differ in at most maxDistance bits, so they share one of maxDistance + 1 bands
+    const std::size_t nBands = maxDistance ? maxDistance + 1 : 0;
+    const std::size_t bandBits = nBands ? 64 / nBands : 0;
+    std::vector<std::unordered_map<std::uint64_t, std::vector<std::size_t>>> bands(nBands);
+    const auto getBand = [&](const std::uint64_t simHash, const std::size_t band) {
+        const std::uint64_t value = simHash >> (band * bandBits);
+        return band + 1 == nBands ? value : value & ((1ULL << bandBits) - 1);
+    };
+
+    std::unordered_map<std::uint64_t, std::vector<std::size_t>> exactGroups;
+    std::vector<std::uint64_t> groupsSimHashes;
+    std::string normalized;
+    std::string candidateNormalized;
+
+    const auto canJoin = [&](const std::size_t group, const std::string& siteName) {
+        return !banSameHosts || result.SitesNames[group].find(siteName) == result.SitesNames[group].end();
+    };
+
+    for (std::size_t i = 0; i < docs.size(); ++i) {
+        const TDBDocument& document = store.Get(docs[i]);
+        Normalize(document, &normalized);
+        const std::vector<std::string_view> words = SplitWords(normalized);
+
+        std::uint64_t exactHash = CalcEmbeddingsHash(document, config);
+        for (const std::string_view word : words) {
+            exactHash = CombineHashes(exactHash, std::hash<std::string_view>()(word));
+        }
+        std::uint64_t simHash = 0;
+        const bool hasSimHash = nBands && CalcSimHash(words, &simHash);
+
+        // Hash hits are confirmed against the representative, so a collision never merges documents
+        std::optional<std::size_t> group;
+        std::vector<std::size_t>& exactCandidates = exactGroups[exactHash];
+        for (const std::size_t candidate : exactCandidates) {
+            if (!canJoin(candidate, document.SiteName)) {
+                continue;
+            }
+            const TDBDocument& representative = store.Get(result.Representatives[candidate]);
+            Normalize(representative, &candidateNormalized);
+            if (candidateNormalized == normalized && HasSameEmbeddings(representative, document, config)) {
+                group = candidate;
+                break;
+            }
+        }
+
+        // Near duplicates are compared with the group representative only, so groups do not drift
+        if (hasSimHash && !group) {
+            const std::uint64_t fetchTime = store.GetFetchTime(docs[i]);
+            for (std::size_t band = 0; !group && band < nBands; ++band) {
+                const auto it = bands[band].find(getBand(simHash, band));
+                if (it == bands[band].end()) {
+                    continue;
+                }
+                for (const std::size_t candidate : it->second) {
+                    const std::uint64_t candidateFetchTime = store.GetFetchTime(result.Representatives[candidate]);
+                    const std::uint64_t timeDiff =
+                        fetchTime > candidateFetchTime ? fetchTime - candidateFetchTime : candidateFetchTime - fetchTime;
+                    if (__builtin_popcountll(groupsSimHashes[candidate] ^ simHash) <= static_cast<int>(maxDistance) &&
+                        (!config.use_timestamp_moving() || timeDiff < NEAR_DUPLICATES_MAX_TIME_DIFF) &&
+                        canJoin(candidate, document.SiteName)) {
+                        group = candidate;
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (group) {
+            result.Groups.push_back(*group);
+            ++result.Weights[*group];
+            if (banSameHosts) {
+                result.SitesNames[*group].insert(document.SiteName);
+            }
+            continue;
+        }
+
+        const std::size_t newGroup = addGroup(i);
+        exactCandidates.push_back(newGroup);
+        groupsSimHashes.push_back(simHash);
+        for (std::size_t band = 0; hasSimHash && band < nBands; ++band) {
+            bands[band][getBand(simHash, band)].push_back(newGroup);
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "driver/config.pb.h"
+
+#include "../../document/impl/document_store.h"
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Documents clustered in place of their exact and near duplicates
+struct TCollapsedDocs {
+    // The first document of every group, in the input order
+    TDocIds Representatives;
+    // Number of documents in every group
+    std::vector<std::size_t> Weights;
+    // Site names of the group documents, filled only when same hosts are banned
+    std::vector<std::unordered_set<std::string>> SitesNames;
+    // Group index of every input document
+    std::vector<std::size_t> Groups;
+};
+
+// Exact duplicates share the normalized title and text and the embeddings, near duplicates
+// are found by SimHash of word shingles. Groups never hold two documents of one site when
+// same hosts are banned. Without collapse_duplicates every document is a group of its own
+TCollapsedDocs CollapseDuplicates(
+    const TDocumentStore& store,
+    const TDocIds& docs,
+    const postly::TClusteringConfig& config);
@@ -0,0 +1,23 @@
+#include "disjoint_set.h"
+
+#include <cassert>
+#include <numeric>
+
+TDisjointSet::TDisjointSet(const std::size_t size)
+    : Parents(size)
+{
+    std::iota(Parents.begin(), Parents.end(), 0);
+}
+
+std::size_t TDisjointSet::Find(std::size_t element) {
+    while (Parents[element] != element) {
+        Parents[element] = Parents[Parents[element]];
+        element = Parents[element];
+    }
+    return element;
+}
+
+void TDisjointSet::Link(const std::size_t root, const std::size_t child) {
+    assert(Parents[root] == root && Parents[child] == child);
+    Parents[child] = root;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+class TDisjointSet {
+public:
+    explicit TDisjointSet(const std::size_t size);
+
+    std::size_t Find(std::size_t element);
+    void Link(const std::size_t root, const std::size_t child);
+
+private:
+    std::vector<std::size_t> Parents;
+};
@@ -0,0 +1,213 @@
+#include "hnsw.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <random>
+
+namespace {
+
+using TCandidate = std::pair<float, std::uint32_t>;
+using TMinQueue = std::priority_queue<TCandidate, std::vector<TCandidate>, std::greater<TCandidate>>;
+using TMaxQueue = std::priority_queue<TCandidate>;
+
+}  // namespace
+
+void THnswIndex::TVisited::Reset() {
+    if (++Epoch == 0) {
+        std::fill(Marks.begin(), Marks.end(), 0);
+        Epoch = 1;
+    }
+}
+
+bool THnswIndex::TVisited::Visit(const std::uint32_t id) {
+    if (Marks[id] == Epoch) {
+        return false;
+    }
+    Marks[id] = Epoch;
+    return true;
+}
+
+THnswIndex::THnswIndex(const TPoints& points,
+                       const std::size_t maxLinks,
+                       const std::size_t efConstruction,
+                       const std::uint64_t seed)
+    : Points(points)
+    , MaxLinks(std::max<std::size_t>(maxLinks, 2))
+    , EfConstruction(std::max(efConstruction, MaxLinks))
+    , Links(points.rows())
+{
+    std::mt19937_64 generator(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    const double levelMultiplier = 1.0 / std::log(static_cast<double>(MaxLinks));
+
+    TVisited visited(Points.rows());
+    for (std::uint32_t id = 0; id < static_cast<std::uint32_t>(Points.rows()); ++id) {
+        const double u = std::max(uniform(generator), std::numeric_limits<double>::min());
+        const int level = static_cast<int>(std::floor(-std::log(u) * levelMultiplier));
+        Insert(id, level, visited);
+    }
+}
+
+std::vector<THnswIndex::TNeighbors> THnswIndex::SearchAll(const std::size_t k, const std::size_t ef) const {
+    const std::size_t nPoints = Points.rows();
+    std::vector<TNeighbors> neighbors(nPoints);
+    if (nPoints < 2) {
+        return neighbors;
+    }
+
+    #pragma omp parallel
+    {
+        TVisited visited(nPoints);
+
+        #pragma omp for schedule(dynamic, 256)
+        for (std::size_t i = 0; i < nPoints; ++i) {
+            const std::uint32_t query = static_cast<std::uint32_t>(i);
+            std::uint32_t entry = EntryPoint;
+            for (int level = MaxLevel; level > 0; --level) {
+                entry = SearchGreedy(query, entry, level);
+            }
+
+            TNeighbors found = SearchLayer(query, entry, std::max(ef, k + 1), 0, visited);
+            found.erase(
+                std::remove_if(found.begin(), found.end(), [query](const TCandidate& c) { return c.second == query; }),
+                found.end());
+            if (found.size() > k) {
+                found.resize(k);
+            }
+            neighbors[i] = std::move(found);
+        }
+    }
+
+    return neighbors;
+}
+
+void THnswIndex::Insert(const std::uint32_t id, const int level, TVisited& visited) {
+    Links[id].resize(level + 1);
+    if (MaxLevel < 0) {
+        EntryPoint = id;
+        MaxLevel = level;
+        return;
+    }
+
+    std::uint32_t entry = EntryPoint;
+    for (int l = MaxLevel; l > level; --l) {
+        entry = SearchGreedy(id, entry, l);
+    }
+
+    for (int l = std::min(level, MaxLevel); l >= 0; --l) {
+        TNeighbors candidates = SearchLayer(id, entry, EfConstruction, l, visited);
+        entry = candidates.front().second;
+
+        Links[id][l] = SelectNeighbors(std::move(candidates), MaxLinks);
+        for (const std::uint32_t neighbor : Links[id][l]) {
+            std::vector<std::uint32_t>& neighborLinks = Links[neighbor][l];
+            neighborLinks.push_back(id);
+            if (neighborLinks.size() <= GetMaxLinks(l)) {
+                continue;
+            }
+
+            TNeighbors shrinked;
+            shrinked.reserve(neighborLinks.size());
+            for (const std::uint32_t link : neighborLinks) {
+                shrinked.emplace_back(Distance(neighbor, link), link);
+            }
+            std::sort(shrinked.begin(), shrinked.end());
+            neighborLinks = SelectNeighbors(std::move(shrinked), GetMaxLinks(l));
+        }
+    }
+
+    if (level > MaxLevel) {
+        EntryPoint = id;
+        MaxLevel = level;
+    }
+}
+
+std::uint32_t THnswIndex::SearchGreedy(const std::uint32_t query, std::uint32_t entry, const int level) const {
+    float bestDistance = Distance(query, entry);
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const std::uint32_t link : Links[entry][level]) {
+            const float distance = Distance(query, link);
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                entry = link;
+                changed = true;
+            }
+        }
+    }
+    return entry;
+}
+
+THnswIndex::TNeighbors THnswIndex::SearchLayer(const std::uint32_t query,
+                                               const std::uint32_t entry,
+                                               const std::size_t ef,
+                                               const int level,
+                                               TVisited& visited) const {
+    visited.Reset();
+    visited.Visit(entry);
+
+    const float entryDistance = Distance(query, entry);
+    TMinQueue candidates;
+    TMaxQueue found;
+    candidates.emplace(entryDistance, entry);
+    found.emplace(entryDistance, entry);
+
+    while (!candidates.empty()) {
+        const TCandidate current = candidates.top();
+        if (current.first > found.top().first && found.size() >= ef) {
+            break;
+        }
+        candidates.pop();
+
+        for (const std::uint32_t link : Links[current.second][level]) {
+            if (!visited.Visit(link)) {
+                continue;
+            }
+            const float distance = Distance(query, link);
+            if (found.size() < ef || distance < found.top().first) {
+                candidates.emplace(distance, link);
+                found.emplace(distance, link);
+                if (found.size() > ef) {
+                    found.pop();
+                }
+            }
+        }
+    }
+
+    TNeighbors result(found.size());
+    for (std::size_t i = result.size(); i > 0; --i) {
+        result[i - 1] = found.top();
+        found.pop();
+    }
+    return result;
+}
+
+std::vector<std::uint32_t> THnswIndex::SelectNeighbors(TNeighbors candidates, const std::size_t maxLinks) const {
+    std::vector<std::uint32_t> selected;
+    std::vector<std::uint32_t> pruned;
+    selected.reserve(maxLinks);
+    for (const auto& [distance, candidate] : candidates) {
+        if (selected.size() >= maxLinks) {
+            break;
+        }
+        const bool isDiverse = std::all_of(selected.begin(), selected.end(),
+            [&, distance = distance, candidate = candidate](const std::uint32_t other) {
+                return Distance(candidate, other) >= distance;
+            });
+        if (isDiverse) {
+            selected.push_back(candidate);
+        } else {
+            pruned.push_back(candidate);
+        }
+    }
+
+    // Near duplicates are pruned by the heuristic, keep them while there is room
+    for (std::size_t i = 0; i < pruned.size() && selected.size() < maxLinks; ++i) {
+        selected.push_back(pruned[i]);
+    }
+    return selected;
+}
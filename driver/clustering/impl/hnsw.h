@@ -0,0 +1,63 @@
+// Hierarchical navigable small world graph, see https://arxiv.org/abs/1603.09320.
+
+#pragma once
+
+#include <Eigen/Core>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class THnswIndex {
+public:
+    using TPoints = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+    using TNeighbors = std::vector<std::pair<float, std::uint32_t>>;
+
+    // Points are compared by negated inner product and must outlive the index
+    THnswIndex(
+        const TPoints& points,
+        const std::size_t maxLinks,
+        const std::size_t efConstruction,
+        const std::uint64_t seed = 42);
+
+    // Approximate k nearest neighbours of every indexed point, itself excluded
+    std::vector<TNeighbors> SearchAll(const std::size_t k, const std::size_t ef) const;
+
+private:
+    class TVisited {
+    public:
+        explicit TVisited(const std::size_t size) : Marks(size, 0) {}
+
+        void Reset();
+        bool Visit(const std::uint32_t id);
+
+    private:
+        std::vector<std::uint32_t> Marks;
+        std::uint32_t Epoch = 0;
+    };
+
+    float Distance(const std::uint32_t lhs, const std::uint32_t rhs) const {
+        return -Points.row(lhs).dot(Points.row(rhs));
+    }
+
+    void Insert(const std::uint32_t id, const int level, TVisited& visited);
+    std::uint32_t SearchGreedy(const std::uint32_t query, std::uint32_t entry, const int level) const;
+    TNeighbors SearchLayer(
+        const std::uint32_t query,
+        const std::uint32_t entry,
+        const std::size_t ef,
+        const int level,
+        TVisited& visited) const;
+    std::vector<std::uint32_t> SelectNeighbors(TNeighbors candidates, const std::size_t maxLinks) const;
+
+    std::size_t GetMaxLinks(const int level) const { return level ? MaxLinks : 2 * MaxLinks; }
+
+private:
+    const TPoints& Points;
+    const std::size_t MaxLinks;
+    const std::size_t EfConstruction;
+
+    std::vector<std::vector<std::vector<std::uint32_t>>> Links;
+    std::uint32_t EntryPoint = 0;
+    int MaxLevel = -1;
+};
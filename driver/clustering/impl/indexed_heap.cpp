@@ -0,0 +1,65 @@
+#include "indexed_heap.h"
+
+#include <numeric>
+#include <utility>
+
+TIndexedHeap::TIndexedHeap(const std::vector<float>& keys)
+    : Keys(keys)
+    , Heap(keys.size())
+    , Positions(keys.size())
+{
+    std::iota(Heap.begin(), Heap.end(), 0);
+    std::iota(Positions.begin(), Positions.end(), 0);
+    for (std::size_t pos = Heap.size() / 2; pos > 0; --pos) {
+        SiftDown(pos - 1);
+    }
+}
+
+void TIndexedHeap::Update(const std::size_t index) {
+    const std::size_t pos = Positions[index];
+    SiftUp(pos);
+    SiftDown(Positions[index]);
+}
+
+bool TIndexedHeap::IsLess(const std::size_t lhs, const std::size_t rhs) const {
+    if (Keys[lhs] == Keys[rhs]) {
+        return lhs < rhs;
+    }
+    return Keys[lhs] < Keys[rhs];
+}
+
+void TIndexedHeap::Swap(const std::size_t lhsPos, const std::size_t rhsPos) {
+    std::swap(Heap[lhsPos], Heap[rhsPos]);
+    Positions[Heap[lhsPos]] = lhsPos;
+    Positions[Heap[rhsPos]] = rhsPos;
+}
+
+void TIndexedHeap::SiftUp(std::size_t pos) {
+    while (pos > 0) {
+        const std::size_t parent = (pos - 1) / 2;
+        if (!IsLess(Heap[pos], Heap[parent])) {
+            break;
+        }
+        Swap(pos, parent);
+        pos = parent;
+    }
+}
+
+void TIndexedHeap::SiftDown(std::size_t pos) {
+    while (true) {
+        const std::size_t left = 2 * pos + 1;
+        const std::size_t right = left + 1;
+        std::size_t smallest = pos;
+        if (left < Heap.size() && IsLess(Heap[left], Heap[smallest])) {
+            smallest = left;
+        }
+        if (right < Heap.size() && IsLess(Heap[right], Heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == pos) {
+            break;
+        }
+        Swap(pos, smallest);
+        pos = smallest;
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Binary min-heap over indices of an external key array, ties are broken by index
+class TIndexedHeap {
+public:
+    explicit TIndexedHeap(const std::vector<float>& keys);
+
+    std::size_t Top() const { return Heap.front(); }
+    void Update(const std::size_t index);
+
+private:
+    bool IsLess(const std::size_t lhs, const std::size_t rhs) const;
+    void Swap(const std::size_t lhsPos, const std::size_t rhsPos);
+    void SiftUp(std::size_t pos);
+    void SiftDown(std::size_t pos);
+
+private:
+    const std::vector<float>& Keys;
+    std::vector<std::size_t> Heap;
+    std::vector<std::size_t> Positions;
+};
@@ -1,10 +1,15 @@
 #include "single_linkage.h"
+#include "disjoint_set.h"
+#include "hnsw.h"
+#include "indexed_heap.h"
 
 #include "../../utils.h"
 
 #include <algorithm>
 #include <fstream>
+#include <future>
 #include <string>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -13,30 +18,12 @@
 namespace {
 
 static const float INF = 1.0f;
+static const std::size_t DISTANCES_BLOCK_SIZE = 128;
 
-void ApplyTimePenalty(const std::vector<TDBDocument>::const_iterator begin,
-                      const std::size_t nDocs,
-                      Eigen::MatrixXf& distances) {
-    std::vector<TDBDocument>::const_iterator slow = begin;
-    std::vector<TDBDocument>::const_iterator fast = begin + 1;
-
-    for (std::size_t i = 0; i < nDocs; ++i, ++slow) {
-        fast = slow + 1;
-        for (std::size_t j = i + 1; j < nDocs; ++j, ++fast) {
-            const std::uint64_t slowTs = slow->FetchTime;
-            const std::uint64_t fastTs = fast->FetchTime;
-            const std::uint64_t tsDiff = fastTs > slowTs ? fastTs - slowTs : slowTs - fastTs;
-            const float hoursDiff = static_cast<float>(tsDiff) / 3600.0f;
-            float penalty = 1.0f;
-
-            if (hoursDiff >= 24.0f) {
-                penalty = hoursDiff / 24.0f;
-            }
-
-            distances(i, j) = std::min(penalty * distances(i, j), INF);
-            distances(j, i) = distances(i, j);
-        }
-    }
+float GetTimePenalty(const std::uint64_t lhsTs, const std::uint64_t rhsTs) {
+    const std::uint64_t tsDiff = lhsTs > rhsTs ? lhsTs - rhsTs : rhsTs - lhsTs;
+    const float hoursDiff = static_cast<float>(tsDiff) / 3600.0f;
+    return hoursDiff >= 24.0f ? hoursDiff / 24.0f : 1.0f;
 }
 
 bool IsAppropriateSize(const std::size_t clusterSize,
@@ -54,24 +41,130 @@ bool IsAppropriateSize(const std::size_t clusterSize,
     return false;
 }
 
-bool SetIntersection(const std::unordered_set<std::string> small,
-                     const std::unordered_set<std::string> large) {
+bool SetIntersection(const std::unordered_set<std::string>& small,
+                     const std::unordered_set<std::string>& large) {
     return std::any_of(small.begin(), small.end(), [&large](const auto& siteName) {
         return large.find(siteName) != large.end();
     });
 }
 
-bool IsSourceIntersect(const std::unordered_set<std::string> lhs,
-                       const std::unordered_set<std::string> rhs) {
+bool IsSourceIntersect(const std::unordered_set<std::string>& lhs,
+                       const std::unordered_set<std::string>& rhs) {
     if (lhs.size() < rhs.size()) {
         return SetIntersection(lhs, rhs);
     }
     return SetIntersection(rhs, lhs);
 }
 
+TClusters MakeClusters(const TDocumentStore& store,
+                       const TDocIds& docs,
+                       const std::vector<std::size_t>& labels) {
+    std::unordered_map<std::size_t, std::size_t> clustersLabels;
+    TClusters clusters;
+    for (std::size_t i = 0; i < docs.size(); ++i) {
+        const std::size_t clusterId = labels[i];
+        auto it = clustersLabels.find(clusterId);
+        if (it == clustersLabels.end()) {
+            const std::size_t currLabel = clusters.size();
+            clustersLabels[clusterId] = currLabel;
+            clusters.emplace_back(currLabel, store);
+            clusters[currLabel].AddDocument(docs[i]);
+        } else {
+            clusters[it->second].AddDocument(docs[i]);
+        }
+    }
+    return clusters;
+}
+
+struct TNormalizedEmbeddings {
+    THnswIndex::TPoints Points;
+    std::vector<bool> IsBad;
+    float Weight = 0.0f;
+    // Int8 codes of quantized documents, their cosines are computed without the float points
+    std::vector<const TQuantizedEmbedding*> Quantized;
+    std::vector<float> QuantizedInvNorms;
+};
+
+float GetCosine(const TNormalizedEmbeddings& embedding, const std::size_t lhs, const std::size_t rhs) {
+    const TQuantizedEmbedding* lhsQuantized = embedding.Quantized[lhs];
+    const TQuantizedEmbedding* rhsQuantized = embedding.Quantized[rhs];
+    if (lhsQuantized && rhsQuantized) {
+        const std::int32_t dot =
+            DotProduct(lhsQuantized->Values.data(), rhsQuantized->Values.data(), lhsQuantized->Values.size());
+        return static_cast<float>(dot) * embedding.QuantizedInvNorms[lhs] * embedding.QuantizedInvNorms[rhs];
+    }
+    return embedding.Points.row(lhs).dot(embedding.Points.row(rhs));
+}
+
+TNormalizedEmbeddings NormalizeEmbeddings(const TDocumentStore& store,
+                                          const TDocIds::const_iterator begin,
+                                          const TDocIds::const_iterator end,
+                                          const postly::EEmbeddingKey embKey,
+                                          const float embWeight) {
+    const std::size_t nDocs = std::distance(begin, end);
+    const std::size_t embSize = store.Get(*begin).GetEmbeddingSize(embKey);
+
+    TNormalizedEmbeddings result;
+    result.Points = THnswIndex::TPoints::Zero(nDocs, embSize);
+    result.IsBad.resize(nDocs, false);
+    result.Weight = embWeight;
+    result.Quantized.resize(nDocs, nullptr);
+    result.QuantizedInvNorms.resize(nDocs, 0.0f);
+    auto doc = begin;
+    for (std::size_t i = 0; i < nDocs; ++i, ++doc) {
+        const TDBDocument& document = store.Get(*doc);
+        ENSURE(document.GetEmbeddingSize(embKey) == embSize, "Bad embedding size in " << document.Filename);
+        auto docVector = result.Points.row(i);
+        document.CopyEmbedding(embKey, docVector.data());
+        const float norm = docVector.norm();
+        if (std::abs(norm - 0.0) > 1e-8) {
+            docVector /= norm;
+        } else {
+            result.IsBad[i] = true;
+        }
+
+        const TQuantizedEmbedding* quantized = document.FindQuantizedEmbedding(embKey);
+        if (quantized && !result.IsBad[i]) {
+            const std::int32_t squaredNorm = DotProduct(quantized->Values.data(), quantized->Values.data(), embSize);
+            if (squaredNorm > 0) {
+                result.Quantized[i] = quantized;
+                result.QuantizedInvNorms[i] = 1.0f / std::sqrt(static_cast<float>(squaredNorm));
+            }
+        }
+    }
+    return result;
+}
+
+struct TEdge {
+    float Distance = 0.0f;
+    std::uint32_t From = 0;
+    std::uint32_t To = 0;
+
+    bool operator<(const TEdge& rhs) const {
+        return std::tie(Distance, From, To) < std::tie(rhs.Distance, rhs.From, rhs.To);
+    }
+};
+
 }  // namspace
 
-TClusters TSlinkClustering::Cluster(const std::vector<TDBDocument>& docs) const {
+TClusters TSlinkClustering::Cluster(const TDocumentStore& store, const TDocIds& docs) const {
+    // Duplicates are linked as their representative, whose weight counts towards the cluster size limits
+    const TCollapsedDocs collapsed = CollapseDuplicates(store, docs, Config);
+    const std::vector<std::size_t> representativesLabels = Config.use_knn_graph()
+        ? ClusterSparse(store, collapsed)
+        : ClusterDense(store, collapsed);
+
+    std::vector<std::size_t> labels(docs.size());
+    for (std::size_t i = 0; i < docs.size(); ++i) {
+        labels[i] = representativesLabels[collapsed.Groups[i]];
+    }
+    return MakeClusters(store, docs, labels);
+}
+
+std::vector<std::size_t> TSlinkClustering::ClusterDense(
+        const TDocumentStore& store,
+        const TCollapsedDocs& collapsed) const {
+    const TDocIds& docs = collapsed.Representatives;
     std::unordered_map<postly::EEmbeddingKey, float> embKeysWeights;
     for (const auto& embKeyWeight : Config.embedding_keys_weights()) {
         embKeysWeights[embKeyWeight.embedding_key()] = embKeyWeight.weight();
@@ -83,22 +176,36 @@ TClusters TSlinkClustering::Cluster(const std::vector<TDBDocument>& docs) const
     std::vector<std::size_t> labels;
     labels.reserve(nDocs);
 
-    std::vector<TDBDocument>::const_iterator begin = docs.cbegin();
-    std::unordered_map<std::size_t, std::size_t> prev2currLabels;
+    // Chunk bounds do not depend on clustering results, so the distances of the
+    // next chunk may be computed while the current one is linked
+    std::vector<std::pair<std::size_t, std::size_t>> batches;
+    for (std::size_t batchStart = 0, prevBatchEnd = 0; prevBatchEnd < nDocs;) {
+        const std::size_t batchSize = std::min(
+            nDocs - batchStart, static_cast<std::size_t>(Config.chunk_size()));
+        batches.emplace_back(batchStart, batchSize);
+        prevBatchEnd = batchStart + batchSize;
+        batchStart = prevBatchEnd - intersectionSize;
+    }
+
+    const auto calcBatchDistances = [&](const std::size_t batchIndex) {
+        const auto batchBegin = docs.cbegin() + batches[batchIndex].first;
+        return CalcDistances(store, batchBegin, batchBegin + batches[batchIndex].second, embKeysWeights);
+    };
 
-    std::size_t batchStart = 0;
-    std::size_t prevBatchEnd = batchStart;
+    std::unordered_map<std::size_t, std::size_t> prev2currLabels;
     std::size_t maxLabel = 0;
+    Eigen::MatrixXf distances = batches.empty() ? Eigen::MatrixXf() : calcBatchDistances(0);
 
-    while (prevBatchEnd < nDocs) {
-        const std::size_t nRemainingDocs = nDocs - batchStart;
-        const std::size_t batchSize = std::min(
-            nRemainingDocs, static_cast<std::size_t>(Config.chunk_size()));
-        auto end = begin + batchSize;
+    for (std::size_t batchIndex = 0; batchIndex < batches.size(); ++batchIndex) {
+        const auto [batchStart, batchSize] = batches[batchIndex];
+        const bool hasNextBatch = batchIndex + 1 < batches.size();
 
-        assert(begin->Url == docs[batchStart].Url);
+        std::future<Eigen::MatrixXf> nextDistances;
+        if (Config.pipeline_chunks() && hasNextBatch) {
+            nextDistances = std::async(std::launch::async, calcBatchDistances, batchIndex + 1);
+        }
 
-        std::vector<std::size_t> currLabels = ClusterBatch(begin, end, embKeysWeights);
+        std::vector<std::size_t> currLabels = ClusterBatch(collapsed, batchStart, batchSize, distances);
         std::for_each(currLabels.begin(), currLabels.end(), [&](std::size_t& i){ i += maxLabel; });
         maxLabel = *std::max_element(currLabels.begin(), currLabels.end());
 
@@ -118,17 +225,17 @@ TClusters TSlinkClustering::Cluster(const std::vector<TDBDocument>& docs) const
             labels.push_back(currLabels[i]);
         }
 
-        assert(batchStart == static_cast<std::size_t>(std::distance(docs.begin(), begin)));
-        assert(batchStart + batchSize == static_cast<std::size_t>(std::distance(docs.begin(), end)));
         for (const auto& [lhs, rhs] : prev2currLabels) {
             UNUSED(lhs);
             UNUSED(rhs);
             assert(lhs < rhs);
         }
 
-        prevBatchEnd = batchStart + batchSize;
-        batchStart = prevBatchEnd - intersectionSize;
-        begin = end - intersectionSize;
+        // Release the linked matrix before the next one is allocated
+        distances = Eigen::MatrixXf();
+        if (hasNextBatch) {
+            distances = nextDistances.valid() ? nextDistances.get() : calcBatchDistances(batchIndex + 1);
+        }
     }
 
     assert(labels.size() == nDocs);
@@ -140,37 +247,125 @@ TClusters TSlinkClustering::Cluster(const std::vector<TDBDocument>& docs) const
         label = it->second;
     }
 
-    std::unordered_map<std::size_t, std::size_t> clustersLabels;
-    TClusters clusters;
-    for (std::size_t i = 0; i < nDocs; ++i) {
-        const std::size_t clusterId = labels[i];
-        auto it = clustersLabels.find(clusterId);
-        if (it == clustersLabels.end()) {
-            const std::size_t currLabel = clusters.size();
-            clustersLabels[clusterId] = currLabel;
-            clusters.emplace_back(currLabel);
-            clusters[currLabel].AddDocument(docs[i]);
-        } else {
-            clusters[it->second].AddDocument(docs[i]);
+    return labels;
+}
+
+std::vector<std::size_t> TSlinkClustering::ClusterSparse(
+        const TDocumentStore& store,
+        const TCollapsedDocs& collapsed) const {
+    const TDocIds& docs = collapsed.Representatives;
+    const std::size_t nDocs = docs.size();
+    if (!nDocs) {
+        return {};
+    }
+
+    std::vector<TNormalizedEmbeddings> embeddings;
+    for (const auto& embKeyWeight : Config.embedding_keys_weights()) {
+        embeddings.push_back(NormalizeEmbeddings(
+            store, docs.begin(), docs.end(), embKeyWeight.embedding_key(), embKeyWeight.weight()));
+    }
+
+    // Inner product of concatenated sqrt(weight)-scaled blocks equals the weighted
+    // sum of cosines, so the graph neighbours are the neighbours of the dense distance
+    std::size_t totalSize = 0;
+    for (const auto& embedding : embeddings) {
+        totalSize += embedding.Points.cols();
+    }
+    THnswIndex::TPoints points(nDocs, totalSize);
+    std::size_t offset = 0;
+    for (const auto& embedding : embeddings) {
+        const std::size_t embSize = embedding.Points.cols();
+        points.middleCols(offset, embSize) = embedding.Points * std::sqrt(embedding.Weight);
+        offset += embSize;
+    }
+
+    const THnswIndex index(points, Config.hnsw_max_links(), Config.hnsw_ef_construction());
+    const std::vector<THnswIndex::TNeighbors> neighbors =
+        index.SearchAll(Config.knn_size(), Config.hnsw_ef_search());
+
+    std::vector<TEdge> edges;
+    edges.reserve(nDocs * Config.knn_size());
+    for (std::uint32_t i = 0; i < nDocs; ++i) {
+        for (const auto& [_, j] : neighbors[i]) {
+            edges.push_back(TEdge{0.0f, std::min(i, j), std::max(i, j)});
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end(), [](const TEdge& lhs, const TEdge& rhs) {
+        return lhs.From == rhs.From && lhs.To == rhs.To;
+    }), edges.end());
+
+    #pragma omp parallel for schedule(static)
+    for (std::size_t e = 0; e < edges.size(); ++e) {
+        TEdge& edge = edges[e];
+        float distance = 0.0f;
+        for (const auto& embedding : embeddings) {
+            if (embedding.IsBad[edge.From] || embedding.IsBad[edge.To]) {
+                distance += embedding.Weight;
+                continue;
+            }
+            const float cosine = GetCosine(embedding, edge.From, edge.To);
+            distance += std::max(embedding.Weight * (1.0f - cosine) / 2.0f, 0.0f);
+        }
+        if (Config.use_timestamp_moving()) {
+            const float penalty = GetTimePenalty(
+                store.GetFetchTime(docs[edge.From]), store.GetFetchTime(docs[edge.To]));
+            distance = std::min(penalty * distance, INF);
         }
+        edge.Distance = distance;
     }
 
-    return clusters;
-}
+    edges.erase(std::remove_if(edges.begin(), edges.end(), [this](const TEdge& edge) {
+        return edge.Distance > Config.small_threshold();
+    }), edges.end());
+    std::sort(edges.begin(), edges.end());
 
-std::vector<std::size_t> TSlinkClustering::ClusterBatch(
-        const std::vector<TDBDocument>::const_iterator begin,
-        const std::vector<TDBDocument>::const_iterator end,
-        const std::unordered_map<postly::EEmbeddingKey, float>& embKeysWeights) const {
-    const std::size_t nDocs = std::distance(begin, end);
-    assert(nDocs);
+    TDisjointSet clustersSet(nDocs);
+    std::vector<std::size_t> clustersSizes = collapsed.Weights;
+    std::vector<std::unordered_set<std::string>> clustersSitesNames = collapsed.SitesNames;
+
+    for (const TEdge& edge : edges) {
+        std::size_t lhs = clustersSet.Find(edge.From);
+        std::size_t rhs = clustersSet.Find(edge.To);
+        if (lhs == rhs) {
+            continue;
+        }
 
-    Eigen::MatrixXf distances = CalcDistances(begin, end, embKeysWeights);
+        const std::size_t newClusterSize = clustersSizes[lhs] + clustersSizes[rhs];
+        if (!IsAppropriateSize(newClusterSize, edge.Distance, Config)) {
+            continue;
+        }
+        if (Config.ban_same_hosts() && IsSourceIntersect(clustersSitesNames[lhs], clustersSitesNames[rhs])) {
+            continue;
+        }
 
-    if (Config.use_timestamp_moving()) {
-        ApplyTimePenalty(begin, nDocs, distances);
+        if (clustersSizes[lhs] < clustersSizes[rhs]) {
+            std::swap(lhs, rhs);
+        }
+        clustersSet.Link(lhs, rhs);
+        clustersSizes[lhs] = newClusterSize;
+        if (Config.ban_same_hosts()) {
+            clustersSitesNames[lhs].insert(clustersSitesNames[rhs].begin(), clustersSitesNames[rhs].end());
+            clustersSitesNames[rhs].clear();
+        }
     }
 
+    std::vector<std::size_t> labels(nDocs);
+    for (std::size_t i = 0; i < nDocs; ++i) {
+        labels[i] = clustersSet.Find(i);
+    }
+
+    return labels;
+}
+
+std::vector<std::size_t> TSlinkClustering::ClusterBatch(
+        const TCollapsedDocs& collapsed,
+        const std::size_t batchStart,
+        const std::size_t batchSize,
+        Eigen::MatrixXf& distances) const {
+    const std::size_t nDocs = batchSize;
+    assert(nDocs);
+
     std::vector<std::size_t> labels(nDocs);
     for (std::size_t i = 0; i < nDocs; ++i) { labels[i] = i; }
 
@@ -182,17 +377,10 @@ std::vector<std::size_t> TSlinkClustering::ClusterBatch(
         nn[i] = minIdx;
     }
 
-    std::vector<std::size_t> clustersSizes(nDocs);
-    std::vector<std::unordered_set<std::string>> clustersSitesNames(nDocs);
-    auto it = begin;
-    for (std::size_t i = 0; i < nDocs; ++i) {
-        clustersSizes[i] = 1;
-        if (Config.ban_same_hosts()) {
-            clustersSitesNames[i].insert(it->SiteName);
-            ++it;
-        }
-    }
-    assert(!Config.ban_same_hosts() || it == end);
+    std::vector<std::size_t> clustersSizes(
+        collapsed.Weights.begin() + batchStart, collapsed.Weights.begin() + batchStart + nDocs);
+    std::vector<std::unordered_set<std::string>> clustersSitesNames(
+        collapsed.SitesNames.begin() + batchStart, collapsed.SitesNames.begin() + batchStart + nDocs);
 
     LinkBatch(distances,
               labels,
@@ -206,43 +394,80 @@ std::vector<std::size_t> TSlinkClustering::ClusterBatch(
 }
 
 Eigen::MatrixXf TSlinkClustering::CalcDistances(
-        const std::vector<TDBDocument>::const_iterator begin,
-        const std::vector<TDBDocument>::const_iterator end,
+        const TDocumentStore& store,
+        const TDocIds::const_iterator begin,
+        const TDocIds::const_iterator end,
         const std::unordered_map<postly::EEmbeddingKey, float>& embKeysWeights) const {
     const std::size_t nDocs = std::distance(begin, end);
     assert(nDocs);
-    Eigen::MatrixXf resDistances = Eigen::MatrixXf::Zero(nDocs, nDocs);
 
+    std::vector<TNormalizedEmbeddings> embeddings;
+    embeddings.reserve(embKeysWeights.size());
     for (const auto& [embKey, embWeight] : embKeysWeights) {
-        const std::size_t embSize = begin->Embeddings.at(embKey).size();
-        Eigen::MatrixXf points(nDocs, embSize);
-        std::vector<std::size_t> badPoints;
-        std::vector<TDBDocument>::const_iterator docs = begin;
-
-        for (std::size_t i = 0; i < nDocs; ++i) {
-            std::vector<float> emb = docs->Embeddings.at(embKey);
-            Eigen::Map<Eigen::VectorXf, Eigen::Unaligned> docVector(emb.data(), emb.size());
-
-            if (std::abs(docVector.norm() - 0.0) > 1e-8) {
-                points.row(i) = docVector / docVector.norm();
-            } else {
-                badPoints.push_back(i);
-            }
+        embeddings.push_back(NormalizeEmbeddings(store, begin, end, embKey, embWeight));
+    }
 
-            docs++;
+    std::vector<std::pair<std::size_t, std::size_t>> blocks;
+    for (std::size_t rowStart = 0; rowStart < nDocs; rowStart += DISTANCES_BLOCK_SIZE) {
+        for (std::size_t colStart = rowStart; colStart < nDocs; colStart += DISTANCES_BLOCK_SIZE) {
+            blocks.emplace_back(rowStart, colStart);
         }
+    }
 
-        Eigen::MatrixXf distances(nDocs, nDocs);
-        distances = (-((points * points.transpose()).array() + 1.0f) / 2.0f + 1.0f) * embWeight;
-        distances += distances.Identity(nDocs, nDocs) * embWeight;
+    // Each upper triangle block is accumulated over all embedding keys in a small
+    // buffer and written once to both halves of the symmetric matrix
+    Eigen::MatrixXf resDistances(nDocs, nDocs);
+    const bool useTimestampMoving = Config.use_timestamp_moving();
+
+    #pragma omp parallel
+    {
+        Eigen::MatrixXf dots;
+        Eigen::MatrixXf blockDistances;
+
+        #pragma omp for schedule(dynamic, 1)
+        for (std::size_t b = 0; b < blocks.size(); ++b) {
+            const auto [rowStart, colStart] = blocks[b];
+            const std::size_t nRows = std::min(DISTANCES_BLOCK_SIZE, nDocs - rowStart);
+            const std::size_t nCols = std::min(DISTANCES_BLOCK_SIZE, nDocs - colStart);
+            blockDistances.setZero(nRows, nCols);
+
+            for (const auto& embedding : embeddings) {
+                const float embWeight = embedding.Weight;
+                dots.noalias() = embedding.Points.middleRows(rowStart, nRows)
+                    * embedding.Points.middleRows(colStart, nCols).transpose();
+
+                for (std::size_t j = 0; j < nCols; ++j) {
+                    const std::size_t col = colStart + j;
+                    const bool isBadCol = embedding.IsBad[col];
+                    for (std::size_t i = 0; i < nRows; ++i) {
+                        const std::size_t row = rowStart + i;
+                        float distance = embWeight;
+                        if (!isBadCol && !embedding.IsBad[row]) {
+                            distance = (-(dots(i, j) + 1.0f) / 2.0f + 1.0f) * embWeight;
+                            if (row == col) {
+                                distance += embWeight;
+                            }
+                        }
+                        blockDistances(i, j) += std::max(distance, 0.0f);
+                    }
+                }
+            }
 
-        for (std::size_t idx : badPoints) {
-            distances.row(idx) = Eigen::VectorXf::Ones(nDocs) * embWeight;
-            distances.col(idx) = Eigen::VectorXf::Ones(nDocs) * embWeight;
+            for (std::size_t j = 0; j < nCols; ++j) {
+                const std::size_t col = colStart + j;
+                const std::uint64_t colFetchTime = store.GetFetchTime(*(begin + col));
+                auto doc = begin + rowStart;
+                for (std::size_t i = 0; i < nRows && rowStart + i <= col; ++i, ++doc) {
+                    const std::size_t row = rowStart + i;
+                    float distance = blockDistances(i, j);
+                    if (useTimestampMoving && row != col) {
+                        distance = std::min(GetTimePenalty(store.GetFetchTime(*doc), colFetchTime) * distance, INF);
+                    }
+                    resDistances(row, col) = distance;
+                    resDistances(col, row) = distance;
+                }
+            }
         }
-
-        distances = distances.cwiseMax(0.0f);
-        resDistances += distances;
     }
 
     return resDistances;
@@ -255,13 +480,17 @@ void TSlinkClustering::LinkBatch(Eigen::MatrixXf& distances,
                                  std::vector<std::size_t>& nn,
                                  std::vector<float>& nnDistances,
                                  const std::size_t nDocs) const {
+    // The matrix is symmetric and column-major, so rows are read through columns.
+    // Merged clusters are deactivated instead of being overwritten with INF
+    TDisjointSet clustersSet(nDocs);
+    TIndexedHeap nearest(nnDistances);
+    std::vector<bool> isActive(nDocs, true);
     float prevMinDist = 0.0f;
 
     for (std::size_t level = 0; level + 1 < nDocs; ++level) {
-        auto minDistIt = std::min_element(nnDistances.begin(), nnDistances.end());
-        const std::size_t minI = std::distance(nnDistances.begin(), minDistIt);
+        const std::size_t minI = nearest.Top();
         const std::size_t minJ = nn[minI];
-        const float minDist = *minDistIt;
+        const float minDist = nnDistances[minI];
         ENSURE(prevMinDist <= minDist, "SLINK non-decreasing distance invariant failed");
         prevMinDist = minDist;
 
@@ -277,34 +506,37 @@ void TSlinkClustering::LinkBatch(Eigen::MatrixXf& distances,
                                        IsSourceIntersect(clustersSitesNames[minI], clustersSitesNames[minJ]);
 
         if (!isApporpriateSize || isSourceIntersect) {
-            nnDistances[minI] = INF;
-            nnDistances[minJ] = INF;
             distances(minI, minJ) = INF;
             distances(minJ, minI) = INF;
 
-            for (std::size_t k = 0; k < static_cast<std::size_t>(distances.rows()); ++k) {
-                if (k == minI || k == minJ) {
+            float iNearestDistance = INF;
+            float jNearestDistance = INF;
+            const float* iColumn = distances.col(minI).data();
+            const float* jColumn = distances.col(minJ).data();
+            for (std::size_t k = 0; k < nDocs; ++k) {
+                if (k == minI || k == minJ || !isActive[k]) {
                     continue;
                 }
-                float iDistance = distances(minI, k);
-                float jDistance = distances(minJ, k);
-                if (iDistance < nnDistances[minI]) {
-                    nnDistances[minI] = iDistance;
+                if (iColumn[k] < iNearestDistance) {
+                    iNearestDistance = iColumn[k];
                     nn[minI] = k;
                 }
-                if (jDistance < nnDistances[minJ]) {
-                    nnDistances[minJ] = jDistance;
+                if (jColumn[k] < jNearestDistance) {
+                    jNearestDistance = jColumn[k];
                     nn[minJ] = k;
                 }
             }
+
+            // Heap keys are changed one at a time, each followed by its update
+            nnDistances[minI] = iNearestDistance;
+            nearest.Update(minI);
+            nnDistances[minJ] = jNearestDistance;
+            nearest.Update(minJ);
             continue;
         }
 
-        for (std::size_t i = 0; i < nDocs; ++i) {
-            if (labels[i] == minJ || labels[i] == labels[minJ]) {
-                labels[i] = minI;
-            }
-        }
+        clustersSet.Link(minI, minJ);
+        isActive[minJ] = false;
 
         clustersSizes[minI] = newClusterSize;
         clustersSizes[minJ] = newClusterSize;
@@ -313,27 +545,35 @@ void TSlinkClustering::LinkBatch(Eigen::MatrixXf& distances,
         }
 
         nnDistances[minI] = INF;
-        for (std::size_t k = 0; k < static_cast<std::size_t>(distances.rows()); ++k) {
-            if (k == minI || k == minJ) {
+        nearest.Update(minI);
+        nnDistances[minJ] = INF;
+        nearest.Update(minJ);
+
+        float iNearestDistance = INF;
+        float* iColumn = distances.col(minI).data();
+        const float* jColumn = distances.col(minJ).data();
+        for (std::size_t k = 0; k < nDocs; ++k) {
+            if (k == minI || k == minJ || !isActive[k]) {
                 continue;
             }
-            const float newDistance = std::min(distances(minJ, k), distances(minI, k));
+            const float newDistance = std::min(jColumn[k], iColumn[k]);
+            iColumn[k] = newDistance;
             distances(minI, k) = newDistance;
-            distances(k, minI) = newDistance;
-            if (newDistance < nnDistances[minI]) {
-                nnDistances[minI] = newDistance;
+            if (newDistance < iNearestDistance) {
+                iNearestDistance = newDistance;
                 nn[minI] = k;
             }
             if (nn[k] == minJ || nn[k] == minI) {
                 nnDistances[k] = newDistance;
                 nn[k] = minI;
+                nearest.Update(k);
             }
         }
+        nnDistances[minI] = iNearestDistance;
+        nearest.Update(minI);
+    }
 
-        nnDistances[minJ] = INF;
-        for (std::size_t i = 0; i < static_cast<std::size_t>(distances.rows()); ++i) {
-            distances(minJ, i) = INF;
-            distances(i, minJ) = INF;
-        }
+    for (std::size_t i = 0; i < nDocs; ++i) {
+        labels[i] = clustersSet.Find(i);
     }
 }
@@ -3,6 +3,7 @@
 #include "driver/config.pb.h"
 
 #include "../clustering.h"
+#include "dedup.h"
 
 #include <Eigen/Core>
 
@@ -14,17 +15,23 @@ public:
     }
 
     TClusters Cluster(
-        const std::vector<TDBDocument>& docs) const override;
+        const TDocumentStore& store,
+        const TDocIds& docs) const override;
 
 private:
+    std::vector<std::size_t> ClusterDense(const TDocumentStore& store, const TCollapsedDocs& collapsed) const;
+    std::vector<std::size_t> ClusterSparse(const TDocumentStore& store, const TCollapsedDocs& collapsed) const;
+
     Eigen::MatrixXf CalcDistances(
-        const std::vector<TDBDocument>::const_iterator begin,
-        const std::vector<TDBDocument>::const_iterator end,
+        const TDocumentStore& store,
+        const TDocIds::const_iterator begin,
+        const TDocIds::const_iterator end,
         const std::unordered_map<postly::EEmbeddingKey, float>& embKeysWeights) const;
     std::vector<size_t> ClusterBatch(
-        const std::vector<TDBDocument>::const_iterator begin,
-        const std::vector<TDBDocument>::const_iterator end,
-        const std::unordered_map<postly::EEmbeddingKey, float>& embKeysWeights) const;
+        const TCollapsedDocs& collapsed,
+        const std::size_t batchStart,
+        const std::size_t batchSize,
+        Eigen::MatrixXf& distances) const;
     void LinkBatch(
         Eigen::MatrixXf& distances,
         std::vector<std::size_t>& labels,
@@ -0,0 +1,20 @@
+#include "change_log.h"
+
+void TChangeLog::Put(const std::string& key, const TDBDocument& doc) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Changes.push_back(TDocumentChange{++SequenceNumber, key, doc});
+}
+
+void TChangeLog::Delete(const std::string& key) {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Changes.push_back(TDocumentChange{++SequenceNumber, key, std::nullopt});
+}
+
+std::vector<TDocumentChange> TChangeLog::Drain() {
+    std::vector<TDocumentChange> changes;
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        changes.swap(Changes);
+    }
+    return changes;
+}
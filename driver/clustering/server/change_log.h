@@ -0,0 +1,30 @@
+#pragma once
+
+#include "../../document/impl/db_document.h"
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct TDocumentChange {
+    std::uint64_t SequenceNumber = 0;
+    std::string Key;
+    std::optional<TDBDocument> Document;
+};
+
+class TChangeLog {
+public:
+    TChangeLog() = default;
+
+    void Put(const std::string& key, const TDBDocument& doc);
+    void Delete(const std::string& key);
+
+    std::vector<TDocumentChange> Drain();
+
+private:
+    std::mutex Mutex;
+    std::uint64_t SequenceNumber = 0;
+    std::vector<TDocumentChange> Changes;
+};
@@ -2,82 +2,268 @@
 
 #include "../../utils.h"
 
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+
 TServerIndex::TServerIndex(std::unique_ptr<TClusterer> clusterer,
                            std::unique_ptr<TSummarizer> summarizer,
-                           rocksdb::DB* db)
+                           std::unique_ptr<TRanker> ranker,
+                           TStorage* storage,
+                           TChangeLog* changeLog,
+                           std::uint64_t reclusteringWindow,
+                           std::uint64_t indexWindow,
+                           bool quantizeEmbeddings)
     : Clusterer(std::move(clusterer))
     , Summarizer(std::move(summarizer))
-    , Db(db)
+    , Ranker(std::move(ranker))
+    , Storage(storage)
+    , ChangeLog(changeLog)
+    , ReclusteringWindow(reclusteringWindow)
+    , IndexWindow(indexWindow)
+    , QuantizeEmbeddings(quantizeEmbeddings)
 {
 }
 
 namespace {
 
-std::pair<std::vector<TDBDocument>, std::uint64_t>
-GetDocs(rocksdb::DB* db) {
-    rocksdb::ManagedSnapshot snapshot(db);
-
-    rocksdb::ReadOptions ropt(true, true);
-    ropt.snapshot = snapshot.snapshot();
+using TKeyedDocs = std::vector<std::pair<std::string, TDBDocument>>;
 
-    std::vector<TDBDocument> docs;
+std::pair<TKeyedDocs, std::uint64_t>
+GetDocs(TStorage* storage, std::uint64_t window, bool quantizeEmbeddings) {
+    TKeyedDocs docs;
     std::uint64_t timestamp = 0;
 
-    std::unique_ptr<rocksdb::Iterator> iter(db->NewIterator(ropt));
-    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
-        const rocksdb::Slice value = iter->value();
-        if (value.empty()) {
-            continue;
-        }
-
-        TDBDocument doc;
-        const bool success = TDBDocument::ParseFromArray(value.data(), value.size(), &doc);
-        if (!success) {
-            LLOG("Bad document in db: " << iter->key().ToString(), ELogLevel::LL_DEBUG);
-            continue;
-        }
-
+    const std::uint64_t maxTimestamp = storage->GetMaxFetchTime();
+    const std::uint64_t fromTimestamp = window ? maxTimestamp - std::min(maxTimestamp, window) : 0;
+    storage->Scan(fromTimestamp, [&](const rocksdb::Slice& key, TDBDocument&& doc) {
         timestamp = std::max(timestamp, doc.FetchTime);
-        docs.push_back(std::move(doc));
-    }
+        if (quantizeEmbeddings) {
+            doc.QuantizeEmbeddings();
+        }
+        docs.emplace_back(key.ToString(), std::move(doc));
+    });
 
     return std::make_pair(std::move(docs), timestamp);
 }
 
-void RemoveStaleDocs(rocksdb::DB* db, std::vector<TDBDocument>& docs, std::uint64_t timestamp) {
-    rocksdb::WriteOptions wopt;
-    for (const auto& doc : docs) {
-        if (doc.IsStale(timestamp)) {
-            db->Delete(wopt, doc.Filename);
-            LLOG("Removed: " << doc.Filename, ELogLevel::LL_DEBUG);
-        }
-    }
+// Stale documents are left to the storage compaction filter
+void RemoveStaleDocs(TKeyedDocs& docs, std::uint64_t timestamp) {
     docs.erase(
         std::remove_if(
             docs.begin(),
             docs.end(),
-            [timestamp](const auto& doc){ return doc.IsStale(timestamp); }
-        ), 
+            [timestamp](const auto& keyedDoc){ return keyedDoc.second.IsStale(timestamp); }
+        ),
         docs.end()
     );
 }
 
+std::uint64_t GetIterTimestamp(std::vector<std::uint64_t>& timestamps, double percentile) {
+    if (timestamps.empty()) {
+        return 0;
+    }
+    const std::size_t index = std::min(
+        static_cast<std::size_t>(std::floor(percentile * timestamps.size())), timestamps.size() - 1);
+    std::nth_element(timestamps.begin(), timestamps.begin() + index, timestamps.end());
+    return timestamps[index];
+}
+
+void SortByMaxTimestamp(TClusters& clusters) {
+    std::stable_sort(
+        clusters.begin(),
+        clusters.end(),
+        [](const TCluster& a, const TCluster& b) {
+            return a.GetMaxTimestamp() < b.GetMaxTimestamp();
+        }
+    );
+}
+
 }  // namespace
 
-TIndex TServerIndex::Build() const {
-    auto [docs, timestamp] = GetDocs(Db);
-    LLOG("Read " << docs.size() << " docs; timestamp: " << timestamp, ELogLevel::LL_DEBUG);
-    RemoveStaleDocs(Db, docs, timestamp);
+std::shared_ptr<TIndex> TServerIndex::Build() {
+    std::shared_ptr<TIndex> index;
+    if (!ChangeLog || !LastIndex) {
+        index = FullBuild();
+    } else {
+        index = IncrementalBuild(ChangeLog->Drain());
+    }
+    if (index != LastIndex) {
+        index->Generation = ++Generation;
+        LastIndex = std::move(index);
+    }
+    return LastIndex;
+}
 
-    TIndex index = Clusterer->Cluster(std::move(docs));
+void TServerIndex::BuildRankedViews(TIndex& index) const {
+    index.RankedViews.clear();
+    for (const auto& [lang, clusters] : index.Clusters) {
+        index.RankedViews[lang] = Ranker->BuildViews(clusters, index.IterTimestamp, index.MaxTimestamp);
+    }
+}
+
+std::shared_ptr<TIndex> TServerIndex::FullBuild() {
+    if (ChangeLog) {
+        // Everything logged so far is already visible in the database snapshot
+        ChangeLog->Drain();
+    }
 
-    for (auto& [lang, clusters] : index.Clusters) {
+    auto [keyedDocs, timestamp] = GetDocs(Storage, IndexWindow, QuantizeEmbeddings);
+    LLOG("Read " << keyedDocs.size() << " docs; timestamp: " << timestamp, ELogLevel::LL_DEBUG);
+    RemoveStaleDocs(keyedDocs, timestamp);
+
+    std::vector<TDocumentStore::TDocumentPtr> docs;
+    docs.reserve(keyedDocs.size());
+    Documents.clear();
+    for (auto& [key, doc] : keyedDocs) {
+        docs.push_back(std::make_shared<const TDBDocument>(std::move(doc)));
+        if (ChangeLog) {
+            Documents.emplace(key, docs.back());
+        }
+    }
+    keyedDocs.clear();
+
+    auto index = std::make_shared<TIndex>(Clusterer->Cluster(std::move(docs)));
+
+    for (auto& [lang, clusters] : index->Clusters) {
         Summarizer->Summarize(clusters);
         LLOG(
             "Clustering output: " << ToString(lang) << " " << clusters.size() << " clusters",
             ELogLevel::LL_DEBUG
         );
     }
+    BuildRankedViews(*index);
+
+    return index;
+}
+
+std::shared_ptr<TIndex> TServerIndex::IncrementalBuild(std::vector<TDocumentChange>&& changes) {
+    if (changes.empty()) {
+        return LastIndex;
+    }
+
+    std::unordered_map<postly::ELanguage, std::uint64_t> changedFrom;
+    const auto markChanged = [&changedFrom](const TDBDocument& doc) {
+        auto [it, inserted] = changedFrom.try_emplace(doc.Language, doc.FetchTime);
+        if (!inserted) {
+            it->second = std::min(it->second, doc.FetchTime);
+        }
+    };
+
+    for (auto& change : changes) {
+        auto it = Documents.find(change.Key);
+        if (it != Documents.end()) {
+            markChanged(*it->second);
+            if (!change.Document) {
+                Documents.erase(it);
+            }
+        }
+        if (change.Document) {
+            markChanged(*change.Document);
+            if (QuantizeEmbeddings) {
+                change.Document->QuantizeEmbeddings();
+            }
+            Documents.insert_or_assign(
+                change.Key, std::make_shared<const TDBDocument>(std::move(*change.Document)));
+        }
+    }
+
+    std::uint64_t timestamp = 0;
+    for (const auto& [_, doc] : Documents) {
+        timestamp = std::max(timestamp, doc->FetchTime);
+    }
+
+    std::vector<std::uint64_t> timestamps;
+    timestamps.reserve(Documents.size());
+    for (auto it = Documents.begin(); it != Documents.end();) {
+        if (it->second->IsStale(timestamp)) {
+            it = Documents.erase(it);
+            continue;
+        }
+        timestamps.push_back(it->second->FetchTime);
+        ++it;
+    }
+
+    // Resident documents are shared with the previous generation, only their ids change
+    auto index = std::make_shared<TIndex>();
+    index->Store = std::make_shared<TDocumentStore>();
+    TDocumentStore& store = *index->Store;
+    store.Reserve(Documents.size());
+    std::unordered_map<const TDBDocument*, TDocId> newIds;
+    newIds.reserve(Documents.size());
+    for (const auto& [_, doc] : Documents) {
+        newIds.emplace(doc.get(), store.Add(doc));
+    }
+
+    index->MaxTimestamp = timestamp;
+    index->IterTimestamp = GetIterTimestamp(timestamps, Clusterer->GetIterTimestampPercentile());
+
+    for (const auto& [lang, prevClusters] : LastIndex->Clusters) {
+        // Clusters that ended before the reclustering window are frozen; anything
+        // overlapping it is dissolved and clustered again together with new documents
+        std::uint64_t splitTimestamp = std::numeric_limits<std::uint64_t>::max();
+        if (const auto it = changedFrom.find(lang); it != changedFrom.end()) {
+            splitTimestamp = it->second - std::min(it->second, ReclusteringWindow);
+        }
+
+        std::size_t frozenEnd = prevClusters.size();
+        while (frozenEnd > 0 && prevClusters[frozenEnd - 1].GetMaxTimestamp() >= splitTimestamp) {
+            splitTimestamp = std::min(splitTimestamp, prevClusters[frozenEnd - 1].GetTimestamp(0.0f));
+            --frozenEnd;
+        }
+
+        TClusters clusters;
+        TClusters prunedClusters;
+        clusters.reserve(prevClusters.size());
+        for (std::size_t i = 0; i < frozenEnd; ++i) {
+            const TCluster& cluster = prevClusters[i];
+            TDocIds docs;
+            docs.reserve(cluster.GetSize());
+            for (const TDocId prevId : cluster.GetDocIds()) {
+                const auto it = newIds.find(cluster.GetStore().GetPtr(prevId).get());
+                if (it != newIds.end()) {
+                    docs.push_back(it->second);
+                }
+            }
+            if (docs.size() == cluster.GetSize()) {
+                clusters.push_back(cluster);
+                clusters.back().Rebind(store, std::move(docs));
+                continue;
+            }
+
+            TCluster pruned(cluster.GetId(), store);
+            for (const TDocId doc : docs) {
+                pruned.AddDocument(doc);
+            }
+            if (pruned.GetSize()) {
+                prunedClusters.push_back(std::move(pruned));
+            }
+        }
+        Summarizer->Summarize(prunedClusters);
+
+        TDocIds windowDocs;
+        for (TDocId doc = 0; doc < store.Size(); ++doc) {
+            if (store.Get(doc).Language == lang && store.GetFetchTime(doc) >= splitTimestamp) {
+                windowDocs.push_back(doc);
+            }
+        }
+        const std::size_t nWindowDocs = windowDocs.size();
+        TClusters freshClusters = Clusterer->ClusterLanguage(lang, store, std::move(windowDocs));
+        Summarizer->Summarize(freshClusters);
+
+        LLOG(
+            "Incremental clustering: " << ToString(lang) << " reclustered " << nWindowDocs
+                << " docs into " << freshClusters.size() << " clusters, kept " << frozenEnd << " clusters",
+            ELogLevel::LL_DEBUG
+        );
+
+        std::move(prunedClusters.begin(), prunedClusters.end(), std::back_inserter(clusters));
+        std::move(freshClusters.begin(), freshClusters.end(), std::back_inserter(clusters));
+        SortByMaxTimestamp(clusters);
+        index->Clusters[lang] = std::move(clusters);
+    }
+    BuildRankedViews(*index);
 
     return index;
-};
\ No newline at end of file
+}
@@ -1,22 +1,47 @@
 #pragma once
 
+#include "change_log.h"
 #include "../clusterer.h"
+#include "../../ranker/ranker.h"
 #include "../../summarizer/summarizer.h"
 
-#include <rocksdb/db.h>
+#include "../../storage/storage.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
 
 class TServerIndex {
 public:
     TServerIndex(
         std::unique_ptr<TClusterer> clusterer,
         std::unique_ptr<TSummarizer> summarizer,
-        rocksdb::DB* db
+        std::unique_ptr<TRanker> ranker,
+        TStorage* storage,
+        TChangeLog* changeLog = nullptr,
+        std::uint64_t reclusteringWindow = 0,
+        std::uint64_t indexWindow = 0,
+        bool quantizeEmbeddings = false
     );
 
-    TIndex Build() const;
+    std::shared_ptr<TIndex> Build();
+    void BuildRankedViews(TIndex& index) const;
+
+private:
+    std::shared_ptr<TIndex> FullBuild();
+    std::shared_ptr<TIndex> IncrementalBuild(std::vector<TDocumentChange>&& changes);
 
 private:
     const std::unique_ptr<TClusterer> Clusterer;
     const std::unique_ptr<TSummarizer> Summarizer;
-    rocksdb::DB* Db;
+    const std::unique_ptr<TRanker> Ranker;
+    TStorage* Storage;
+
+    TChangeLog* ChangeLog;
+    const std::uint64_t ReclusteringWindow;
+    const std::uint64_t IndexWindow;
+    const bool QuantizeEmbeddings;
+    std::unordered_map<std::string, TDocumentStore::TDocumentPtr> Documents;
+    std::shared_ptr<TIndex> LastIndex;
+    std::uint64_t Generation = 0;
 };
@@ -0,0 +1,156 @@
+#include "snapshot.h"
+
+#include "driver/index.pb.h"
+
+#include "../../io/mapped_file.h"
+#include "../../utils.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <string_view>
+
+#include <unistd.h>
+
+namespace {
+
+// A snapshot is a sequence of records, each a little-endian 64-bit size followed by a message:
+// a TIndexProto header without languages, then TLanguageClustersProto parts. A language may span
+// several parts, so no single message grows beyond what protobuf can parse
+static const char SNAPSHOT_MAGIC[] = "PSNP0002";
+static const std::size_t MAGIC_SIZE = sizeof(SNAPSHOT_MAGIC) - 1;
+static const std::size_t RECORD_SIZE_SIZE = 8;
+static const std::size_t MAX_PART_SIZE = 64 << 20;
+
+bool WriteRecord(const google::protobuf::MessageLite& message, std::ostream& out) {
+    const std::uint64_t size = message.ByteSizeLong();
+    char sizeBytes[RECORD_SIZE_SIZE];
+    for (std::size_t i = 0; i < RECORD_SIZE_SIZE; ++i) {
+        sizeBytes[i] = static_cast<char>((size >> (8 * i)) & 0xFF);
+    }
+    out.write(sizeBytes, RECORD_SIZE_SIZE);
+    return out && size <= static_cast<std::uint64_t>(std::numeric_limits<int>::max())
+        && message.SerializeToOstream(&out);
+}
+
+bool ReadRecord(std::string_view* data, google::protobuf::MessageLite* message) {
+    if (data->size() < RECORD_SIZE_SIZE) {
+        return false;
+    }
+    std::uint64_t size = 0;
+    for (std::size_t i = 0; i < RECORD_SIZE_SIZE; ++i) {
+        size |= static_cast<std::uint64_t>(static_cast<unsigned char>((*data)[i])) << (8 * i);
+    }
+    data->remove_prefix(RECORD_SIZE_SIZE);
+    if (size > data->size() || size > static_cast<std::uint64_t>(std::numeric_limits<int>::max())) {
+        return false;
+    }
+    const bool parsed = message->ParseFromArray(data->data(), static_cast<int>(size));
+    data->remove_prefix(size);
+    return parsed;
+}
+
+bool WriteIndex(const TIndex& index, std::ostream& out) {
+    out.write(SNAPSHOT_MAGIC, MAGIC_SIZE);
+
+    postly::TIndexProto header;
+    header.set_iter_timestamp(index.IterTimestamp);
+    header.set_max_timestamp(index.MaxTimestamp);
+    if (!WriteRecord(header, out)) {
+        return false;
+    }
+
+    for (const auto& [lang, clusters] : index.Clusters) {
+        postly::TLanguageClustersProto part;
+        part.set_language(lang);
+        std::size_t partSize = 0;
+        for (const TCluster& cluster : clusters) {
+            auto* clusterProto = part.add_clusters();
+            *clusterProto = cluster.ToProto();
+            partSize += clusterProto->ByteSizeLong();
+            if (partSize >= MAX_PART_SIZE) {
+                if (!WriteRecord(part, out)) {
+                    return false;
+                }
+                part.clear_clusters();
+                partSize = 0;
+            }
+        }
+        if (part.clusters_size() && !WriteRecord(part, out)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::shared_ptr<TIndex> ReadIndex(std::string_view data) {
+    if (data.substr(0, MAGIC_SIZE) != std::string_view(SNAPSHOT_MAGIC, MAGIC_SIZE)) {
+        return nullptr;
+    }
+    data.remove_prefix(MAGIC_SIZE);
+
+    postly::TIndexProto header;
+    if (!ReadRecord(&data, &header)) {
+        return nullptr;
+    }
+    auto index = std::make_shared<TIndex>();
+    index->Store = std::make_shared<TDocumentStore>();
+    index->IterTimestamp = header.iter_timestamp();
+    index->MaxTimestamp = header.max_timestamp();
+
+    postly::TLanguageClustersProto part;
+    while (!data.empty()) {
+        if (!ReadRecord(&data, &part)) {
+            return nullptr;
+        }
+        TClusters& clusters = index->Clusters[part.language()];
+        clusters.reserve(clusters.size() + part.clusters_size());
+        for (const auto& clusterProto : part.clusters()) {
+            clusters.push_back(TCluster::FromProto(clusterProto, *index->Store));
+        }
+    }
+    return index;
+}
+
+}  // namespace
+
+bool SaveIndexSnapshot(const TIndex& index, const std::string& path) {
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out || !WriteIndex(index, out)) {
+            LLOG("Failed to write index snapshot: " << tmpPath, ELogLevel::LL_WARN);
+            return false;
+        }
+        out.flush();
+        if (!out) {
+            LLOG("Failed to write index snapshot: " << tmpPath, ELogLevel::LL_WARN);
+            return false;
+        }
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        LLOG("Failed to rename index snapshot: " << tmpPath, ELogLevel::LL_WARN);
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<TIndex> LoadIndexSnapshot(const std::string& path) {
+    if (access(path.c_str(), F_OK) != 0) {
+        LLOG("No index snapshot: " << path, ELogLevel::LL_INFO);
+        return nullptr;
+    }
+
+    const TMappedFile file(path);
+    if (!file.IsOpen() || !file.GetSize()) {
+        LLOG("Failed to map index snapshot: " << path, ELogLevel::LL_WARN);
+        return nullptr;
+    }
+
+    std::shared_ptr<TIndex> index = ReadIndex(file.GetView());
+    if (!index) {
+        LLOG("Bad index snapshot: " << path, ELogLevel::LL_WARN);
+    }
+    return index;
+}
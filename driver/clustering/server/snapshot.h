@@ -0,0 +1,14 @@
+#pragma once
+
+#include "../clusterer.h"
+
+#include <memory>
+#include <string>
+
+// Writes the index to a temporary file and renames it over the snapshot path.
+// Clusters are stored in parts of about 64MB, so the snapshot size is not limited
+// by protobuf, only a single cluster has to stay below 2GB
+bool SaveIndexSnapshot(const TIndex& index, const std::string& path);
+
+// Returns nullptr if the snapshot is missing or broken
+std::shared_ptr<TIndex> LoadIndexSnapshot(const std::string& path);
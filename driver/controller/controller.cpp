@@ -4,9 +4,14 @@
 
 #include "../cluster/cluster.h"
 #include "../document/document.h"
+#include "../document/json_reader.h"
 #include "../utils.h"
 
+#include <charconv>
+#include <future>
 #include <optional>
+#include <string_view>
+#include <unordered_map>
 
 #include <tinyxml2/tinyxml2.h>
 
@@ -19,6 +24,20 @@ void BuildSimpleResponse(std::function<void(const drogon::HttpResponsePtr&)>&& c
     callback(resp);
 }
 
+// Pool tasks are not guarded by drogon, a failed annotation is answered with 500
+// instead of terminating the worker
+template <class TFunc>
+void RunRequestTask(std::function<void(const drogon::HttpResponsePtr&)>& callback, TFunc&& func) {
+    try {
+        func();
+    } catch (const std::exception& e) {
+        LLOG("Request task failed: " << e.what(), ELogLevel::LL_ERROR);
+        if (callback) {
+            BuildSimpleResponse(std::move(callback), drogon::k500InternalServerError);
+        }
+    }
+}
+
 std::optional<std::int64_t> GetTtlHeader(const std::string& value) {
     try {
         if (value == "no-cache") {
@@ -63,52 +82,114 @@ Json::Value ToJson(const TCluster& cluster) {
     return json;
 }
 
-std::optional<nlohmann::json> ParseRequestBody(const drogon::HttpRequestPtr& req) {
-    nlohmann::json body;
-    const auto requestBody = req->getJsonObject();
-    bool valid = true;
+const TRankedView* FindRankedView(const TIndex& index,
+                                  const postly::ELanguage lang,
+                                  const std::uint64_t period) {
+    const auto viewsIt = index.RankedViews.find(lang);
+    if (viewsIt == index.RankedViews.end()) {
+        return nullptr;
+    }
+    const TRankedViews& views = viewsIt->second;
+    const auto it = std::lower_bound(views.begin(), views.end(), period,
+        [](const TRankedView& view, const std::uint64_t period) { return view.Period < period; });
+    return it != views.end() && it->Period == period ? &*it : nullptr;
+}
 
-    if (!requestBody->isMember("url")) {
-        valid &= false;
+std::string_view GetBodyView(const drogon::HttpRequestPtr& req) {
+    const auto& requestBody = req->getBody();
+    return std::string_view(requestBody.data(), requestBody.size());
+}
+
+// The file name falls back to the path parameter
+std::optional<TDocument> ParseRequestBody(const drogon::HttpRequestPtr& req) {
+    TDocument document;
+    if (!ReadJsonDocument(GetBodyView(req), &document)) {
+        return std::nullopt;
     }
-    if (!requestBody->isMember("title")) {
-        valid &= false;
+    if (document.Filename.empty()) {
+        document.Filename = req->getParameter("path");
     }
-    if (!requestBody->isMember("text")) {
-        valid &= false;
+    if (document.Filename.empty()) {
+        return std::nullopt;
     }
-    if (!requestBody->isMember("file_name")) {
-        valid &= false;
+    return document;
+}
+
+drogon::HttpResponsePtr BuildCachedResponse(const TResponseCache::TEntry& entry, const bool acceptsGzip) {
+    auto resp = drogon::HttpResponse::newHttpResponse();
+    resp->setContentTypeCode(drogon::CT_APPLICATION_JSON);
+    if (acceptsGzip && !entry.GzipBody.empty()) {
+        resp->addHeader("Content-Encoding", "gzip");
+        resp->setBody(entry.GzipBody);
+    } else {
+        resp->setBody(entry.Body);
     }
+    return resp;
+}
 
-    if (!valid) {
+// The ttl field of an item overrides the Cache-Control header
+std::optional<TDocument> ParseBatchItem(const std::string_view item, std::int64_t* ttl) {
+    TDocument document;
+    bool validTtl = true;
+    const bool parsed = ReadJsonDocument(item, &document,
+        [ttl, &validTtl](const std::string_view key, const std::string_view value) {
+            if (key != "ttl") {
+                return;
+            }
+            const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), *ttl);
+            validTtl = error == std::errc() && end == value.data() + value.size();
+        });
+    if (!parsed || !validTtl || document.Filename.empty()) {
         return std::nullopt;
     }
+    return document;
+}
 
-    body["url"] = requestBody->get("url", "").asString();
-    body["site_name"] = requestBody->get("site_name", "").asString();
-    body["timestamp"] = requestBody->get("timestamp", 0).asUInt64();
-    body["title"] = requestBody->get("title", "").asString();
-    body["description"] = requestBody->get("description", "").asString();
-    body["text"] = requestBody->get("text", "").asString();
-    body["file_name"] = requestBody->get("file_name", "").asString();
-    if (requestBody->isMember("language")) {
-        body["language"] = requestBody->get("language", "").asString();
+// Either a json array or one json document per line, the items point into the body
+std::optional<std::vector<std::string_view>> ParseBatchBody(std::string_view body) {
+    std::vector<std::string_view> items;
+    const std::size_t start = body.find_first_not_of(" \t\r\n");
+    if (start == std::string_view::npos) {
+        return items;
     }
 
-    return body;
+    if (body[start] == '[') {
+        if (!SplitJsonArray(body, &items)) {
+            return std::nullopt;
+        }
+        return items;
+    }
+
+    while (!body.empty()) {
+        const std::size_t end = std::min(body.find('\n'), body.size());
+        const std::string_view line = body.substr(0, end);
+        body.remove_prefix(std::min(end + 1, body.size()));
+        if (line.find_first_not_of(" \t\r") == std::string_view::npos) {
+            continue;
+        }
+        items.push_back(line);
+    }
+    return items;
 }
 
 }  // namespace
 
 void TController::Init(const TAtomic<TIndex>* index,
-                       rocksdb::DB* db,
+                       TStorage* storage,
                        std::unique_ptr<TAnnotator> annotator,
-                       std::unique_ptr<TRanker> ranker) {
+                       std::unique_ptr<TRanker> ranker,
+                       TChangeLog* changeLog,
+                       postly::EEmbeddingEncoding embeddingEncoding,
+                       std::unique_ptr<TThreadPool> annotatorPool,
+                       std::unique_ptr<TResponseCache> responseCache) {
     Index = index;
-    DB = db;
+    Storage = storage;
     Annotator = std::move(annotator);
+    AnnotatorPool = annotatorPool ? std::move(annotatorPool) : std::make_unique<TThreadPool>();
     Ranker = std::move(ranker);
+    ResponseCache = std::move(responseCache);
+    ChangeLog = changeLog;
+    EmbeddingEncoding = embeddingEncoding;
     Initialized.store(true, std::memory_order_release);
 }
 
@@ -122,32 +203,35 @@ bool TController::IsReady(std::function<void(const drogon::HttpResponsePtr &)> &
 }
 
 std::optional<TDBDocument>
-TController::GetDBDocFromReq(const nlohmann::json& json) const {
-    return Annotator->ProcessJson(json);
+TController::GetDBDocFromReq(const TDocument& document) const {
+    return Annotator->ProcessDocument(document);
 }
 
 bool TController::IndexDBDoc(const TDBDocument& doc,
                              const std::string& fname) const {
     ENSURE(doc.IsFullyIndexed(), "Trying to index a document without required fields");
 
-    std::string serializedDoc;
-    bool ok = doc.ToProtoString(&serializedDoc);
-    if (!ok) {
-        return false;
+    postly::TDocumentProto proto = doc.ToProto(EmbeddingEncoding);
+    std::optional<TDBDocument> decodedDoc;
+    if (ChangeLog && EmbeddingEncoding != postly::EE_FLOAT32) {
+        // Lossy encodings are decoded back, so the change log matches the database
+        decodedDoc = TDBDocument::FromProto(proto);
     }
-    const rocksdb::Status status = DB->Put(rocksdb::WriteOptions(), fname, serializedDoc);
+
+    const rocksdb::Status status = Storage->Put(fname, std::move(proto));
     if (!status.ok()) {
         return false;
     }
+    if (ChangeLog) {
+        ChangeLog->Put(fname, decodedDoc ? *decodedDoc : doc);
+    }
     return true;
 }
 
 drogon::HttpStatusCode TController::GetCode(const std::string& fname,
                                             const drogon::HttpStatusCode createdCode,
                                             const drogon::HttpStatusCode existedCode) const {
-    std::string val;
-    const auto mayExist = DB->KeyMayExist(rocksdb::ReadOptions(), fname, &val);
-    return mayExist ? existedCode : createdCode;
+    return Storage->KeyMayExist(fname) ? existedCode : createdCode;
 }
 
 void TController::Put(const drogon::HttpRequestPtr& req,
@@ -156,17 +240,6 @@ void TController::Put(const drogon::HttpRequestPtr& req,
         return;
     }
 
-    const auto maybeBody = ParseRequestBody(req);
-    if (!maybeBody.has_value()) {
-        BuildSimpleResponse(std::move(callback), drogon::k400BadRequest);
-        return;
-    }
-    const nlohmann::json body = maybeBody.value();
-    std::string fname = body["file_name"];
-    if (!fname.size()) {
-        fname = req->getParameter("path");
-    }
-
     const std::optional<std::int64_t> ttl = GetTtlHeader(req->getHeader("Cache-Control"));
     if (!ttl.has_value() || ttl.value() == -1) {
         LLOG("Request TTL is empty", ELogLevel::LL_ERROR);
@@ -174,26 +247,42 @@ void TController::Put(const drogon::HttpRequestPtr& req,
         return;
     }
 
-    std::optional<TDBDocument> doc = GetDBDocFromReq(body);
-    if (!doc.has_value()) {
-        BuildSimpleResponse(std::move(callback), drogon::k400BadRequest);
-        return;
+    // Parsing and annotation are done by the pool, the event loop is not blocked
+    const bool enqueued = AnnotatorPool->TryEnqueue(
+        [this, req, ttl = ttl.value(), callback]() mutable {
+            RunRequestTask(callback, [&] {
+                const std::optional<TDocument> document = ParseRequestBody(req);
+                if (!document.has_value()) {
+                    BuildSimpleResponse(std::move(callback), drogon::k400BadRequest);
+                    return;
+                }
+                const std::string& fname = document->Filename;
+
+                std::optional<TDBDocument> doc = GetDBDocFromReq(document.value());
+                if (!doc.has_value()) {
+                    BuildSimpleResponse(std::move(callback), drogon::k400BadRequest);
+                    return;
+                }
+                doc->TTL = ttl;
+
+                if (!doc->IsFullyIndexed()) {
+                    BuildSimpleResponse(std::move(callback), drogon::k400BadRequest);
+                    return;
+                }
+
+                const drogon::HttpStatusCode code = GetCode(fname, drogon::k201Created, drogon::k204NoContent);
+                bool ok = IndexDBDoc(doc.value(), fname);
+                if (!ok) {
+                    BuildSimpleResponse(std::move(callback), drogon::k500InternalServerError);
+                    return;
+                }
+
+                BuildSimpleResponse(std::move(callback), code);
+            });
+        });
+    if (!enqueued) {
+        BuildSimpleResponse(std::move(callback), drogon::k429TooManyRequests);
     }
-    doc->TTL = ttl.value();
-
-    if (!doc->IsFullyIndexed()) {
-        BuildSimpleResponse(std::move(callback), drogon::k400BadRequest);
-        return;
-    }
-
-    const drogon::HttpStatusCode code = GetCode(fname, drogon::k201Created, drogon::k204NoContent);
-    bool ok = IndexDBDoc(doc.value(), fname);
-    if (!ok) {
-        BuildSimpleResponse(std::move(callback), drogon::k500InternalServerError);
-        return;
-    }
-
-    BuildSimpleResponse(std::move(callback), code);
 }
 
 void TController::Delete(const drogon::HttpRequestPtr& req,
@@ -204,14 +293,16 @@ void TController::Delete(const drogon::HttpRequestPtr& req,
 
     const std::string fname = req->getParameter("path");
 
-    std::string val;
-    const bool mayExist = DB->KeyMayExist(rocksdb::ReadOptions(), fname, &val);
+    const bool mayExist = Storage->KeyMayExist(fname);
     if (mayExist) {
-        const rocksdb::Status status = DB->Delete(rocksdb::WriteOptions(), fname);
+        const rocksdb::Status status = Storage->Delete(fname);
         if (!status.ok()) {
             BuildSimpleResponse(std::move(callback), drogon::k500InternalServerError);
             return;
         }
+        if (ChangeLog) {
+            ChangeLog->Delete(fname);
+        }
     }
 
     BuildSimpleResponse(
@@ -233,35 +324,56 @@ void TController::Threads(const drogon::HttpRequestPtr& req,
         return;
     }
 
-    const std::shared_ptr<TIndex> index = Index->Get();
+    const auto index = Index->GetLocal();
 
-    TClusters clusters;
-    if (index->Clusters.count(lang.value())) {
-        clusters = index->Clusters.at(lang.value());
+    const TResponseCache::TKey cacheKey{index->Generation, lang.value(), category.value(), period.value()};
+    const bool acceptsGzip = req->getHeader("Accept-Encoding").find("gzip") != std::string::npos;
+    if (ResponseCache) {
+        if (const auto entry = ResponseCache->Find(cacheKey)) {
+            callback(BuildCachedResponse(*entry, acceptsGzip));
+            return;
+        }
     }
 
-    const std::uint64_t fromTimestamp =
-        index->MaxTimestamp > period.value() ? index->MaxTimestamp - period.value() : 0;
-
-    const auto indexIt =
-        std::lower_bound(clusters.cbegin(), clusters.cend(), fromTimestamp);
-    const auto weightedClusters =
-        Ranker->Rank(indexIt, clusters.cend(), index->IterTimestamp, period.value());
-    const auto& categoryClusters = weightedClusters.at(category.value());
+    static const TClusters emptyClusters;
+    const auto clustersIt = index->Clusters.find(lang.value());
+    const TClusters& clusters = clustersIt != index->Clusters.end() ? clustersIt->second : emptyClusters;
 
     Json::Value threads(Json::arrayValue);
-    int limit = 1000;
-    for (const auto& weightedCluster : categoryClusters) {
-        if (limit <= 0) {
-            break;
+    const std::size_t limit = 1000;
+
+    const TRankedView* view = FindRankedView(*index, lang.value(), period.value());
+    if (view) {
+        const auto& categoryClusters = view->Clusters.at(category.value());
+        for (std::size_t i = 0; i < std::min(limit, categoryClusters.size()); ++i) {
+            threads.append(ToJson(clusters[categoryClusters[i]]));
+        }
+    } else {
+        const std::uint64_t fromTimestamp =
+            index->MaxTimestamp > period.value() ? index->MaxTimestamp - period.value() : 0;
+
+        const auto indexIt =
+            std::lower_bound(clusters.cbegin(), clusters.cend(), fromTimestamp);
+        const auto weightedClusters =
+            Ranker->Rank(indexIt, clusters.cend(), index->IterTimestamp, period.value());
+        const auto& categoryClusters = weightedClusters.at(category.value());
+        for (std::size_t i = 0; i < std::min(limit, categoryClusters.size()); ++i) {
+            threads.append(ToJson(categoryClusters[i].Cluster.get()));
         }
-        const TCluster& cluster = weightedCluster.Cluster.get();
-        threads.append(ToJson(cluster));
-        --limit;
     }
 
     Json::Value json(Json::objectValue);
     json["threads"] = std::move(threads);
+    if (ResponseCache) {
+        static const Json::StreamWriterBuilder writerBuilder = [] {
+            Json::StreamWriterBuilder builder;
+            builder["indentation"] = "";
+            return builder;
+        }();
+        const auto entry = ResponseCache->Insert(cacheKey, Json::writeString(writerBuilder, json));
+        callback(BuildCachedResponse(*entry, acceptsGzip));
+        return;
+    }
     auto resp = drogon::HttpResponse::newHttpJsonResponse(json);
     callback(resp);
 }
@@ -274,16 +386,15 @@ void TController::Get(const drogon::HttpRequestPtr& req,
 
     const std::string fname = req->getParameter("path");
 
-    std::string serializedDoc;
-    const rocksdb::Status s = DB->Get(rocksdb::ReadOptions(), fname, &serializedDoc);
+    postly::TDocumentProto doc;
+    const rocksdb::Status s = Storage->GetMeta(fname, &doc);
 
     Json::Value ret;
     ret["fname"] = fname;
-    ret["status"] = s.ok() ? "fetched" : "no such key";
+    ret["status"] = s.ok() || s.IsCorruption() ? "fetched" : "no such key";
 
-    if (s.ok()) {
-        postly::TDocumentProto doc;
-        const auto suc = doc.ParseFromString(serializedDoc);
+    if (s.ok() || s.IsCorruption()) {
+        const auto suc = s.ok();
         ret["parsed"] = suc;
         if (suc) {
             ret["title"] = doc.title();
@@ -295,6 +406,24 @@ void TController::Get(const drogon::HttpRequestPtr& req,
         }
     }
 
+    // Bodies live in a separate column family and are read only when asked for
+    const std::string withBody = req->getParameter("body");
+    if (s.ok() && (withBody == "1" || withBody == "true")) {
+        postly::TDocumentBodyProto body;
+        const rocksdb::Status bodyStatus = Storage->GetBody(fname, &body);
+        if (bodyStatus.ok()) {
+            ret["text"] = body.text();
+            ret["desc"] = body.desc();
+            Json::Value outLinks(Json::arrayValue);
+            for (const std::string& link : body.out_links()) {
+                outLinks.append(link);
+            }
+            ret["out_links"] = std::move(outLinks);
+        } else if (!bodyStatus.IsNotFound()) {
+            LLOG("Failed to read body of " << fname << ": " << bodyStatus.ToString(), ELogLevel::LL_WARN);
+        }
+    }
+
     auto resp = drogon::HttpResponse::newHttpJsonResponse(ret);
     callback(resp);
 }
@@ -305,56 +434,204 @@ void TController::Post(const drogon::HttpRequestPtr& req,
         return;
     }
 
-    const auto maybeBody = ParseRequestBody(req);
-    if (!maybeBody.has_value()) {
+    const std::optional<int64_t> ttl = GetTtlHeader(req->getHeader("Cache-Control"));
+    if (!ttl) {
         BuildSimpleResponse(std::move(callback), drogon::k400BadRequest);
         return;
     }
-    const nlohmann::json body = maybeBody.value();
-    std::string fname = body["file_name"];
-    if (!fname.size()) {
-        fname = req->getParameter("path");
+
+    const bool enqueued = AnnotatorPool->TryEnqueue(
+        [this, req, ttl = ttl.value(), callback]() mutable {
+            RunRequestTask(callback, [&] {
+                const std::optional<TDocument> document = ParseRequestBody(req);
+                if (!document.has_value()) {
+                    BuildSimpleResponse(std::move(callback), drogon::k400BadRequest);
+                    return;
+                }
+                const std::string& fname = document->Filename;
+
+                std::optional<TDBDocument> dbDoc = GetDBDocFromReq(document.value());
+                if (!dbDoc) {
+                    BuildSimpleResponse(std::move(callback), drogon::k400BadRequest);
+                    return;
+                }
+
+                drogon::HttpStatusCode code = GetCode(fname, drogon::k201Created, drogon::k200OK);
+                bool isIndexed = dbDoc->IsFullyIndexed() && ttl != -1;
+                if (isIndexed) {
+                    dbDoc->TTL = ttl;
+                    bool success = IndexDBDoc(dbDoc.value(), fname);
+                    if (!success) {
+                        BuildSimpleResponse(std::move(callback), drogon::k500InternalServerError);
+                        return;
+                    }
+                } else {
+                    code = drogon::k200OK;
+                }
+
+                Json::Value json(Json::objectValue);
+                json["lang_code"] = dbDoc->HasSupportedLanguage() ? ToString(dbDoc->Language) : Json::Value::null;
+                json["is_news"] = dbDoc->Category != postly::NC_UNDEFINED ? dbDoc->IsNews() : Json::Value::null;
+                json["is_indexed"] = isIndexed;
+                json["filename"] = fname;
+                Json::Value categories(Json::arrayValue);
+                if (dbDoc->IsNews()) {
+                    categories.append(ToString(dbDoc->Category));
+                }
+                json["categories"] = categories;
+
+                auto resp = drogon::HttpResponse::newHttpJsonResponse(json);
+                resp->setStatusCode(code);
+                callback(resp);
+            });
+        });
+    if (!enqueued) {
+        BuildSimpleResponse(std::move(callback), drogon::k429TooManyRequests);
     }
+}
 
-    const std::optional<int64_t> ttl = GetTtlHeader(req->getHeader("Cache-Control"));
-    if (!ttl) {
-        BuildSimpleResponse(std::move(callback), drogon::k400BadRequest);
+struct TController::TBatchState {
+    struct TItem {
+        std::string Fname;
+        std::string Status = "bad_request";
+        std::int64_t Ttl = -1;
+        std::optional<TDBDocument> Doc;
+    };
+
+    // Items are views into the request body
+    drogon::HttpRequestPtr Request;
+    std::vector<TItem> Items;
+    // The dispatching thread holds one reference until every document is enqueued
+    std::atomic<std::size_t> Pending = 1;
+    std::function<void(const drogon::HttpResponsePtr&)> Callback;
+};
+
+void TController::Batch(const drogon::HttpRequestPtr& req,
+                        std::function<void(const drogon::HttpResponsePtr&)>&& callback) const {
+    if (!IsReady(std::move(callback))) {
         return;
     }
 
-    std::optional<TDBDocument> dbDoc = GetDBDocFromReq(body);
-    if (!dbDoc) {
+    std::optional<std::vector<std::string_view>> items = ParseBatchBody(GetBodyView(req));
+    if (!items) {
         BuildSimpleResponse(std::move(callback), drogon::k400BadRequest);
         return;
     }
+    const std::optional<std::int64_t> defaultTtl = GetTtlHeader(req->getHeader("Cache-Control"));
+
+    // The last finished annotation commits the batch and responds
+    auto state = std::make_shared<TBatchState>();
+    state->Request = req;
+    state->Items.resize(items->size());
+    state->Callback = std::move(callback);
+    std::size_t nEnqueued = 0;
+    std::size_t nRejected = 0;
+    for (std::size_t i = 0; i < items->size(); ++i) {
+        // The name is read here, so rejected items still report which document to retry
+        ReadJsonStringField((*items)[i], "file_name", &state->Items[i].Fname);
+        state->Pending.fetch_add(1);
+        const bool enqueued = AnnotatorPool->TryEnqueue([this, state, i, json = (*items)[i], defaultTtl] {
+            TBatchState::TItem& item = state->Items[i];
+            try {
+                item.Ttl = defaultTtl.value_or(-1);
+                const std::optional<TDocument> document = ParseBatchItem(json, &item.Ttl);
+                if (document) {
+                    item.Doc = GetDBDocFromReq(document.value());
+                }
+            } catch (const std::exception& e) {
+                LLOG("Batch item " << item.Fname << " failed: " << e.what(), ELogLevel::LL_ERROR);
+                item.Doc.reset();
+                item.Status = "error";
+            }
+            if (state->Pending.fetch_sub(1) == 1) {
+                RunRequestTask(state->Callback, [&] { FinishBatch(*state); });
+            }
+        });
+        if (enqueued) {
+            ++nEnqueued;
+        } else {
+            state->Pending.fetch_sub(1);
+            state->Items[i].Status = "rejected";
+            ++nRejected;
+        }
+    }
+    items.reset();
 
-    drogon::HttpStatusCode code = GetCode(fname, drogon::k201Created, drogon::k200OK);
-    bool isIndexed = dbDoc->IsFullyIndexed() && ttl.value() != -1;
-    if (isIndexed) {
-        dbDoc->TTL = ttl.value();
-        bool success = IndexDBDoc(dbDoc.value(), fname);
-        if (!success) {
-            BuildSimpleResponse(std::move(callback), drogon::k500InternalServerError);
-            return;
+    if (!nEnqueued && nRejected) {
+        BuildSimpleResponse(std::move(state->Callback), drogon::k429TooManyRequests);
+        return;
+    }
+    if (state->Pending.fetch_sub(1) == 1) {
+        RunRequestTask(state->Callback, [&] { FinishBatch(*state); });
+    }
+}
+
+void TController::FinishBatch(TBatchState& state) const {
+    std::vector<std::pair<std::string, postly::TDocumentProto>> protos;
+    std::vector<std::size_t> indexed;
+    // Items sharing a file name are applied in order, so only the last indexed one is written
+    std::unordered_map<std::string_view, std::size_t> lastIndexed;
+    for (std::size_t i = 0; i < state.Items.size(); ++i) {
+        TBatchState::TItem& item = state.Items[i];
+        if (!item.Doc) {
+            continue;
         }
-    } else {
-        code = drogon::k200OK;
+        if (!item.Doc->IsFullyIndexed() || item.Ttl == -1) {
+            item.Status = "not_indexed";
+            continue;
+        }
+        lastIndexed[item.Fname] = i;
+    }
+    for (std::size_t i = 0; i < state.Items.size(); ++i) {
+        TBatchState::TItem& item = state.Items[i];
+        if (!item.Doc || item.Status == "not_indexed") {
+            continue;
+        }
+        if (lastIndexed.at(item.Fname) != i) {
+            item.Status = "superseded";
+            continue;
+        }
+        item.Doc->TTL = item.Ttl;
+        item.Status = Storage->KeyMayExist(item.Fname) ? "updated" : "created";
+        protos.emplace_back(item.Fname, item.Doc->ToProto(EmbeddingEncoding));
+        if (ChangeLog && EmbeddingEncoding != postly::EE_FLOAT32) {
+            // Lossy encodings are decoded back, so the change log matches the database
+            item.Doc = TDBDocument::FromProto(protos.back().second);
+        }
+        indexed.push_back(i);
     }
 
-    Json::Value json(Json::objectValue);
-    json["lang_code"] = dbDoc->HasSupportedLanguage() ? ToString(dbDoc->Language) : Json::Value::null;
-    json["is_news"] = dbDoc->Category != postly::NC_UNDEFINED ? dbDoc->IsNews() : Json::Value::null;
-    json["is_indexed"] = isIndexed;
-    json["filename"] = fname;
-    Json::Value categories(Json::arrayValue);
-    if (dbDoc->IsNews()) {
-        categories.append(ToString(dbDoc->Category));
+    if (!protos.empty()) {
+        const rocksdb::Status status = Storage->PutBatch(std::move(protos));
+        for (const std::size_t i : indexed) {
+            if (!status.ok()) {
+                state.Items[i].Status = "error";
+            } else if (ChangeLog) {
+                ChangeLog->Put(state.Items[i].Fname, *state.Items[i].Doc);
+            }
+        }
     }
-    json["categories"] = categories;
 
-    auto resp = drogon::HttpResponse::newHttpJsonResponse(json);
-    resp->setStatusCode(code);
-    callback(resp);
+    Json::Value documents(Json::arrayValue);
+    for (const TBatchState::TItem& item : state.Items) {
+        Json::Value json(Json::objectValue);
+        json["filename"] = item.Fname;
+        json["status"] = item.Status;
+        if (item.Doc) {
+            json["lang_code"] = item.Doc->HasSupportedLanguage() ? ToString(item.Doc->Language) : Json::Value::null;
+            json["is_news"] = item.Doc->Category != postly::NC_UNDEFINED ? item.Doc->IsNews() : Json::Value::null;
+            Json::Value categories(Json::arrayValue);
+            if (item.Doc->IsNews()) {
+                categories.append(ToString(item.Doc->Category));
+            }
+            json["categories"] = categories;
+        }
+        documents.append(std::move(json));
+    }
+
+    Json::Value json(Json::objectValue);
+    json["documents"] = std::move(documents);
+    state.Callback(drogon::HttpResponse::newHttpJsonResponse(json));
 }
 
 void TController::Ping(const drogon::HttpRequestPtr& req,
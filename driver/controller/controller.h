@@ -5,9 +5,11 @@
 #include "../clustering/server/index.h"
 #include "../atomic/atomic.h"
 #include "../ranker/ranker.h"
+#include "response_cache.h"
+#include "../storage/storage.h"
+#include "../thread_pool/thread_pool.h"
 
 #include <drogon/HttpController.h>
-#include <rocksdb/db.h>
 
 class TController : public drogon::HttpController<TController, false> {
 public:
@@ -17,14 +19,19 @@ public:
         ADD_METHOD_TO(TController::Delete, "/delete?path=", { drogon::Delete });
         ADD_METHOD_TO(TController::Get, "/get?path=", { drogon::Get });
         ADD_METHOD_TO(TController::Post, "/post?path=", { drogon::Post });
+        ADD_METHOD_TO(TController::Batch, "/batch", { drogon::Post });
         ADD_METHOD_TO(TController::Ping, "/ping", { drogon::Get });
     METHOD_LIST_END
 
     void Init(
         const TAtomic<TIndex>* index,
-        rocksdb::DB* db,
+        TStorage* storage,
         std::unique_ptr<TAnnotator> annotator,
-        std::unique_ptr<TRanker> ranker);
+        std::unique_ptr<TRanker> ranker,
+        TChangeLog* changeLog = nullptr,
+        postly::EEmbeddingEncoding embeddingEncoding = postly::EE_FLOAT32,
+        std::unique_ptr<TThreadPool> annotatorPool = nullptr,
+        std::unique_ptr<TResponseCache> responseCache = nullptr);
     void Put(
         const drogon::HttpRequestPtr& req,
         std::function<void(const drogon::HttpResponsePtr&)>&& callback) const;
@@ -40,17 +47,23 @@ public:
     void Post(
         const drogon::HttpRequestPtr& req,
         std::function<void(const drogon::HttpResponsePtr&)>&& callback) const;
+    void Batch(
+        const drogon::HttpRequestPtr& req,
+        std::function<void(const drogon::HttpResponsePtr&)>&& callback) const;
     void Ping(
         const drogon::HttpRequestPtr& req,
         std::function<void(const drogon::HttpResponsePtr&)>&& callback) const;
 
 private:
+    struct TBatchState;
+
     bool IsReady(
         std::function<void(const drogon::HttpResponsePtr&)> &&callback) const;
-    std::optional<TDBDocument> GetDBDocFromReq(const nlohmann::json& json) const;
+    std::optional<TDBDocument> GetDBDocFromReq(const TDocument& document) const;
     bool IndexDBDoc(
         const TDBDocument& doc,
         const std::string& fname) const;
+    void FinishBatch(TBatchState& state) const;
     drogon::HttpStatusCode GetCode(
         const std::string& fname,
         drogon::HttpStatusCode createdCode,
@@ -61,7 +74,11 @@ private:
 
     const TAtomic<TIndex>* Index;
 
-    rocksdb::DB* DB;
+    TStorage* Storage;
     std::unique_ptr<TAnnotator> Annotator;
+    std::unique_ptr<TThreadPool> AnnotatorPool;
     std::unique_ptr<TRanker> Ranker;
+    std::unique_ptr<TResponseCache> ResponseCache;
+    TChangeLog* ChangeLog = nullptr;
+    postly::EEmbeddingEncoding EmbeddingEncoding = postly::EE_FLOAT32;
 };
@@ -0,0 +1,64 @@
+#include "response_cache.h"
+
+#include "../utils.h"
+
+#include <drogon/utils/Utilities.h>
+
+#include <functional>
+#include <mutex>
+
+bool TResponseCache::TKey::operator==(const TKey& other) const {
+    return Generation == other.Generation
+        && Language == other.Language
+        && Category == other.Category
+        && Period == other.Period;
+}
+
+std::size_t TResponseCache::TKeyHash::operator()(const TKey& key) const {
+    std::size_t hash = std::hash<std::uint64_t>()(key.Period);
+    hash = hash * 31 + std::hash<int>()(key.Language);
+    hash = hash * 31 + std::hash<int>()(key.Category);
+    return hash * 31 + std::hash<std::uint64_t>()(key.Generation);
+}
+
+TResponseCache::TResponseCache(const std::size_t maxSize, const bool gzip)
+    : MaxSize(maxSize)
+    , Gzip(gzip)
+{
+}
+
+std::shared_ptr<const TResponseCache::TEntry> TResponseCache::Find(const TKey& key) {
+    {
+        std::shared_lock<std::shared_mutex> lock(Mutex);
+        const auto it = Entries.find(key);
+        if (it != Entries.end()) {
+            Hits.fetch_add(1, std::memory_order_relaxed);
+            return it->second;
+        }
+    }
+    Misses.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+}
+
+std::shared_ptr<const TResponseCache::TEntry> TResponseCache::Insert(const TKey& key, std::string&& body) {
+    auto entry = std::make_shared<TEntry>();
+    entry->Body = std::move(body);
+    if (Gzip) {
+        entry->GzipBody = drogon::utils::gzipCompress(entry->Body.data(), entry->Body.size());
+    }
+
+    std::unique_lock<std::shared_mutex> lock(Mutex);
+    if (key.Generation > Generation) {
+        LLOG(
+            "Response cache: generation " << Generation << " had " << Entries.size() << " entries, "
+                << Hits.exchange(0) << " hits, " << Misses.exchange(0) << " misses",
+            ELogLevel::LL_INFO
+        );
+        Entries.clear();
+        Generation = key.Generation;
+    }
+    if (key.Generation == Generation && Entries.size() < MaxSize) {
+        Entries.emplace(key, entry);
+    }
+    return entry;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "driver/enum.pb.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+// Serialized /threads responses of the current index generation. Responses
+// can only change with the index, so a newer generation drops all entries
+class TResponseCache {
+public:
+    struct TKey {
+        std::uint64_t Generation = 0;
+        postly::ELanguage Language = postly::NL_UNDEFINED;
+        postly::ECategory Category = postly::NC_UNDEFINED;
+        std::uint64_t Period = 0;
+
+        bool operator==(const TKey& other) const;
+    };
+
+    struct TEntry {
+        std::string Body;
+        // Empty if compression is disabled
+        std::string GzipBody;
+    };
+
+    TResponseCache(std::size_t maxSize, bool gzip);
+
+    std::shared_ptr<const TEntry> Find(const TKey& key);
+    // Entries of outdated generations or beyond maxSize are returned, but not stored
+    std::shared_ptr<const TEntry> Insert(const TKey& key, std::string&& body);
+
+private:
+    struct TKeyHash {
+        std::size_t operator()(const TKey& key) const;
+    };
+
+    const std::size_t MaxSize;
+    const bool Gzip;
+
+    std::shared_mutex Mutex;
+    std::uint64_t Generation = 0;
+    std::unordered_map<TKey, std::shared_ptr<const TEntry>, TKeyHash> Entries;
+
+    std::atomic<std::uint64_t> Hits = 0;
+    std::atomic<std::uint64_t> Misses = 0;
+};
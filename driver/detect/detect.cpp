@@ -4,28 +4,54 @@
 #include "../utils.h"
 
 #include <algorithm>
+#include <cmath>
+#include <istream>
+#include <streambuf>
 #include <utility>
 #include <optional>
-#include <sstream>
 #include <vector>
 
 namespace {
 
+// Reads a line in place, fastText only takes its input from streams
+class TLineStreamBuf : public std::streambuf {
+public:
+    explicit TLineStreamBuf(const std::string_view line) {
+        char* data = const_cast<char*>(line.data());
+        setg(data, data, data + line.size());
+    }
+};
+
+// Word n-gram ids are added by a protected dictionary method, it is reached through a member pointer
+struct TDictionaryAccess : fasttext::Dictionary {
+    static constexpr auto AddWordNgrams = &TDictionaryAccess::addWordNgrams;
+};
+
+std::vector<std::int32_t> GetLineWordIds(const fasttext::FastText& model, const std::string_view line) {
+    TLineStreamBuf buffer(line);
+    std::istream stream(&buffer);
+    std::vector<std::int32_t> words;
+    std::vector<std::int32_t> labels;
+    model.getDictionary()->getLine(stream, words, labels);
+    return words;
+}
+
 std::optional<std::pair<std::string, double>>
 GetCategory(const fasttext::FastText& model,
-            const std::string& originalText,
+            const std::vector<std::int32_t>& words,
             const double threshold) {
-    std::string text = originalText;
-    std::replace(text.begin(), text.end(), '\n', ' ');
-    std::istringstream ifs(text);
-    std::vector<std::pair<fasttext::real, std::string>> predictions;
-    model.predictLine(ifs, predictions, 1, threshold);
+    if (words.empty()) {
+        return std::nullopt;
+    }
+    fasttext::Predictions predictions;
+    model.predict(1, words, predictions, threshold);
     if (predictions.empty()) {
         return std::nullopt;
     }
-    double probability = predictions[0].first;
+    // Predictions hold log probabilities
+    const double probability = std::exp(predictions[0].first);
     const size_t FT_PREFIX_LENGTH = 9;
-    const std::string label = predictions[0].second.substr(FT_PREFIX_LENGTH);
+    const std::string label = model.getDictionary()->getLabel(predictions[0].second).substr(FT_PREFIX_LENGTH);
     return std::make_pair(label, probability);
 }
 
@@ -75,7 +101,8 @@ bool IsDirtyDoc(const TDocument& doc) {
 postly::ELanguage DetectLanguage(const fasttext::FastText& model,
                                  const TDocument& doc) {
     std::string sample(doc.Title + " " + doc.Description + " " + doc.Text.substr(0, 100));
-    auto pair = GetCategory(model, sample, 0.4);
+    std::replace(sample.begin(), sample.end(), '\n', ' ');
+    auto pair = GetCategory(model, GetLineWordIds(model, sample), 0.4);
     if (!pair) {
         return postly::NL_UNDEFINED;
     }
@@ -93,9 +120,47 @@ postly::ELanguage DetectLanguage(const fasttext::FastText& model,
     return postly::NL_OTHER;
 }
 
-postly::ECategory DetectCategory(const fasttext::FastText& model,
-                                 const std::string& title) {
-    auto categ = GetCategory(model, title, 0.1);
+std::vector<std::vector<std::int32_t>> GetWordIds(const fasttext::FastText& model,
+                                                  const std::vector<TTokenSpan>& texts) {
+    // Same ids as Dictionary::getLine gives for the tokens joined into a line
+    const fasttext::Dictionary& dictionary = *model.getDictionary();
+    const std::int32_t wordNgrams = model.getArgs().wordNgrams;
 
-    return categ.has_value() ? FromString<postly::ECategory>(categ->first) : postly::NC_UNDEFINED;
+    std::vector<std::vector<std::int32_t>> textsWordIds(texts.size());
+    std::vector<std::int32_t> hashes;
+    std::string token;
+    for (std::size_t i = 0; i < texts.size(); ++i) {
+        std::vector<std::int32_t>& wordIds = textsWordIds[i];
+        hashes.clear();
+        for (const std::string_view tokenView : texts[i]) {
+            token.assign(tokenView);
+            const std::uint32_t hash = dictionary.hash(token);
+            const std::int32_t id = dictionary.getId(token, hash);
+            const fasttext::entry_type type = id < 0 ? dictionary.getType(token) : dictionary.getType(id);
+            if (type != fasttext::entry_type::word) {
+                continue;
+            }
+            if (id < 0) {
+                const std::vector<std::int32_t> subwords = dictionary.getSubwords(token);
+                wordIds.insert(wordIds.end(), subwords.begin(), subwords.end());
+            } else {
+                const std::vector<std::int32_t>& subwords = dictionary.getSubwords(id);
+                wordIds.insert(wordIds.end(), subwords.begin(), subwords.end());
+            }
+            hashes.push_back(hash);
+        }
+        (dictionary.*TDictionaryAccess::AddWordNgrams)(wordIds, hashes, wordNgrams);
+    }
+    return textsWordIds;
+}
+
+std::vector<postly::ECategory> DetectCategories(const fasttext::FastText& model,
+                                                const std::vector<std::vector<std::int32_t>>& textsWordIds) {
+    std::vector<postly::ECategory> categories;
+    categories.reserve(textsWordIds.size());
+    for (const std::vector<std::int32_t>& wordIds : textsWordIds) {
+        const auto categ = GetCategory(model, wordIds, 0.1);
+        categories.push_back(categ.has_value() ? FromString<postly::ECategory>(categ->first) : postly::NC_UNDEFINED);
+    }
+    return categories;
 }
@@ -1,9 +1,13 @@
 #pragma once
 
 #include "../document/impl/db_document.h"
+#include "../document/tokenized_text.h"
 
 #include <fasttext.h>
 
+#include <cstdint>
+#include <vector>
+
 struct TDocument;
 
 namespace fasttext {
@@ -12,5 +16,10 @@ class FastText;
 
 postly::ELanguage DetectLanguage(const fasttext::FastText& model,
                                  const TDocument& doc);
-postly::ECategory DetectCategory(const fasttext::FastText& model,
-                                 const std::string& title);
+
+// fastText input ids of every token span, the ids the model gets for a line of these tokens
+std::vector<std::vector<std::int32_t>> GetWordIds(const fasttext::FastText& model,
+                                                  const std::vector<TTokenSpan>& texts);
+// Category of every text given by its word ids, NC_UNDEFINED when nothing passes the threshold
+std::vector<postly::ECategory> DetectCategories(const fasttext::FastText& model,
+                                                const std::vector<std::vector<std::int32_t>>& textsWordIds);
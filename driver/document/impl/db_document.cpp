@@ -1,9 +1,18 @@
 #include "db_document.h"
+#include "embedding_codec.h"
 
 #include "../../utils.h"
 
+#include <algorithm>
+
 TDBDocument TDBDocument::FromProto(const postly::TDocumentProto& proto) {
     TDBDocument document;
+    ENSURE(FromProto(proto, &document), "Bad embeddings in document " << proto.filename());
+    return document;
+}
+
+bool TDBDocument::FromProto(const postly::TDocumentProto& proto, TDBDocument* result) {
+    TDBDocument document;
 
     document.Filename = proto.filename();
     document.Url = proto.url();
@@ -24,37 +33,35 @@ TDBDocument TDBDocument::FromProto(const postly::TDocumentProto& proto) {
     }
 
     for (const auto& embedding : proto.embeddings()) {
-        const auto& value_proto = embedding.value();
-        TEmbedding value(value_proto.cbegin(), value_proto.cend());
+        TEmbedding value;
+        if (!DecodeEmbedding(embedding, &value)) {
+            return false;
+        }
 
         const auto [_, ok] =
             document.Embeddings.try_emplace(embedding.key(), std::move(value));
-        ENSURE(ok, "Duplicated key");
+        if (!ok) {
+            return false;
+        }
     }
 
-    return document;
+    *result = std::move(document);
+    return true;
 }
 
 bool TDBDocument::FromProtoString(const std::string& value, TDBDocument* document) {
     postly::TDocumentProto proto;
-    if (proto.ParseFromString(value)) {
-        *document = FromProto(proto);
-        return true;
-    }
-    return false;
+    return proto.ParseFromString(value) && FromProto(proto, document);
 }
 
 bool TDBDocument::ParseFromArray(const void* data, const int size, TDBDocument* document) {
     postly::TDocumentProto proto;
-    if (proto.ParseFromArray(data, size)) {
-        *document = FromProto(proto);
-        return true;
-    }
-    return false;
+    return proto.ParseFromArray(data, size) && FromProto(proto, document);
 }
 
-postly::TDocumentProto TDBDocument::ToProto() const {
+postly::TDocumentProto TDBDocument::ToProto(const postly::EEmbeddingEncoding encoding) const {
     postly::TDocumentProto proto;
+    proto.set_format_version(2);
 
     proto.set_filename(Filename);
     proto.set_url(Url);
@@ -72,7 +79,13 @@ postly::TDocumentProto TDBDocument::ToProto() const {
     for (const auto& [key, val] : Embeddings) {
         auto* embeddingProto = proto.add_embeddings();
         embeddingProto->set_key(key);
-        *embeddingProto->mutable_value() = {val.cbegin(), val.cend()};
+        EncodeEmbedding(val, encoding, embeddingProto);
+    }
+    // Quantized embeddings are written as they are, whatever the requested encoding
+    for (const auto& [key, val] : QuantizedEmbeddings) {
+        auto* embeddingProto = proto.add_embeddings();
+        embeddingProto->set_key(key);
+        EncodeEmbedding(val, embeddingProto);
     }
     for (const auto& link : OutLinks) {
         proto.add_out_links(link);
@@ -101,6 +114,39 @@ nlohmann::json TDBDocument::ToJson() const {
     return json;
 }
 
-bool TDBDocument::ToProtoString(std::string* protoString) const {
-    return ToProto().SerializeToString(protoString);
+bool TDBDocument::ToProtoString(std::string* protoString,
+                                const postly::EEmbeddingEncoding encoding) const {
+    return ToProto(encoding).SerializeToString(protoString);
+}
+
+std::size_t TDBDocument::GetEmbeddingSize(const postly::EEmbeddingKey key) const {
+    if (const auto it = Embeddings.find(key); it != Embeddings.end()) {
+        return it->second.size();
+    }
+    if (const auto it = QuantizedEmbeddings.find(key); it != QuantizedEmbeddings.end()) {
+        return it->second.Values.size();
+    }
+    return 0;
+}
+
+void TDBDocument::CopyEmbedding(const postly::EEmbeddingKey key, float* out) const {
+    if (const auto it = Embeddings.find(key); it != Embeddings.end()) {
+        std::copy(it->second.begin(), it->second.end(), out);
+        return;
+    }
+    const auto it = QuantizedEmbeddings.find(key);
+    ENSURE(it != QuantizedEmbeddings.end(), "No embedding " << ToString(key) << " in " << Filename);
+    DequantizeEmbedding(it->second, out);
+}
+
+const TQuantizedEmbedding* TDBDocument::FindQuantizedEmbedding(const postly::EEmbeddingKey key) const {
+    const auto it = QuantizedEmbeddings.find(key);
+    return it != QuantizedEmbeddings.end() ? &it->second : nullptr;
+}
+
+void TDBDocument::QuantizeEmbeddings() {
+    for (const auto& [key, embedding] : Embeddings) {
+        QuantizedEmbeddings.insert_or_assign(key, QuantizeEmbedding(embedding));
+    }
+    Embeddings.clear();
 }
@@ -2,6 +2,8 @@
 
 #include "driver/document.pb.h"
 
+#include "embedding_codec.h"
+
 #include <nlohmann_json/json.hpp>
 
 #include <string>
@@ -29,24 +31,38 @@ public:
     postly::ECategory Category = postly::ECategory::NC_UNDEFINED;
     
     std::unordered_map<postly::EEmbeddingKey, TEmbedding> Embeddings;
+    // Resident documents may keep int8 embeddings instead of the float ones
+    std::unordered_map<postly::EEmbeddingKey, TQuantizedEmbedding> QuantizedEmbeddings;
     std::vector<std::string> OutLinks;
     
     bool IsNasty = false;
 
 public:
     static TDBDocument FromProto(const postly::TDocumentProto& proto);
+    // Returns false for broken embeddings instead of throwing
+    static bool FromProto(const postly::TDocumentProto& proto, TDBDocument* document);
     static bool FromProtoString(const std::string& value, TDBDocument* document);
     static bool ParseFromArray(const void* data, int size, TDBDocument* document);
 
-    postly::TDocumentProto ToProto() const;
+    postly::TDocumentProto ToProto(
+        const postly::EEmbeddingEncoding encoding = postly::EE_FLOAT32) const;
     nlohmann::json ToJson() const;
-    bool ToProtoString(std::string* protoString) const;
+    bool ToProtoString(
+        std::string* protoString,
+        const postly::EEmbeddingEncoding encoding = postly::EE_FLOAT32) const;
 
     bool IsRussian() const { return Language == postly::NL_RU; }
     bool IsEnglish() const { return Language == postly::NL_EN; }
     bool IsNews() const { return Category != postly::NC_NOT_NEWS && Category != postly::NC_UNDEFINED; }
-    bool IsFullyIndexed() const { return Language != postly::NL_UNDEFINED && Category != postly::NC_UNDEFINED && !Embeddings.empty(); }
+    bool IsFullyIndexed() const { return Language != postly::NL_UNDEFINED && Category != postly::NC_UNDEFINED && HasEmbeddings(); }
     bool HasSupportedLanguage() const { return Language != postly::NL_UNDEFINED && Language != postly::NL_OTHER; }
 
     bool IsStale(uint64_t timestamp) const { return timestamp > FetchTime + TTL; }
+
+    bool HasEmbeddings() const { return !Embeddings.empty() || !QuantizedEmbeddings.empty(); }
+    std::size_t GetEmbeddingSize(postly::EEmbeddingKey key) const;
+    // Writes GetEmbeddingSize(key) float values, quantized embeddings are restored
+    void CopyEmbedding(postly::EEmbeddingKey key, float* out) const;
+    const TQuantizedEmbedding* FindQuantizedEmbedding(postly::EEmbeddingKey key) const;
+    void QuantizeEmbeddings();
 };
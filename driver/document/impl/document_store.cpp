@@ -0,0 +1,27 @@
+#include "document_store.h"
+
+TDocId TDocumentStore::Add(TDocumentPtr document) {
+    const TDocId id = static_cast<TDocId>(Documents.size());
+
+    const auto [hostIt, inserted] = HostsIndex.try_emplace(document->Host, Hosts.size());
+    if (inserted) {
+        Hosts.push_back(document->Host);
+    }
+
+    FetchTimes.push_back(document->FetchTime);
+    HostIds.push_back(hostIt->second);
+    Titles.emplace_back(document->Title);
+    Documents.push_back(std::move(document));
+    return id;
+}
+
+TDocId TDocumentStore::Add(TDBDocument&& document) {
+    return Add(std::make_shared<const TDBDocument>(std::move(document)));
+}
+
+void TDocumentStore::Reserve(const std::size_t size) {
+    Documents.reserve(size);
+    FetchTimes.reserve(size);
+    HostIds.reserve(size);
+    Titles.reserve(size);
+}
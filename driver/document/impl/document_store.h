@@ -0,0 +1,94 @@
+#pragma once
+
+#include "db_document.h"
+
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using TDocId = std::uint32_t;
+using TDocIds = std::vector<TDocId>;
+
+// Documents of one index generation. Documents themselves are immutable and
+// may be shared with other generations; hot fields are kept in flat arrays
+class TDocumentStore {
+public:
+    using TDocumentPtr = std::shared_ptr<const TDBDocument>;
+
+    TDocumentStore() = default;
+    TDocumentStore(const TDocumentStore&) = delete;
+    TDocumentStore& operator=(const TDocumentStore&) = delete;
+
+    TDocId Add(TDocumentPtr document);
+    TDocId Add(TDBDocument&& document);
+    void Reserve(const std::size_t size);
+
+    std::size_t Size() const { return Documents.size(); }
+    const TDBDocument& Get(const TDocId id) const { return *Documents[id]; }
+    const TDocumentPtr& GetPtr(const TDocId id) const { return Documents[id]; }
+
+    std::uint64_t GetFetchTime(const TDocId id) const { return FetchTimes[id]; }
+    std::uint32_t GetHostId(const TDocId id) const { return HostIds[id]; }
+    const std::string& GetHost(const TDocId id) const { return Hosts[HostIds[id]]; }
+    std::string_view GetTitle(const TDocId id) const { return Titles[id]; }
+
+private:
+    std::vector<TDocumentPtr> Documents;
+    std::vector<std::uint64_t> FetchTimes;
+    std::vector<std::uint32_t> HostIds;
+    std::vector<std::string_view> Titles;
+
+    std::vector<std::string> Hosts;
+    std::unordered_map<std::string, std::uint32_t> HostsIndex;
+};
+
+// Documents of a subset of the store, iterated in the order of their ids
+class TDocumentRange {
+public:
+    class TIterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = TDBDocument;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const TDBDocument*;
+        using reference = const TDBDocument&;
+
+        TIterator(const TDocumentStore* store, TDocIds::const_iterator it)
+            : Store(store)
+            , It(it)
+        {
+        }
+
+        reference operator*() const { return Store->Get(*It); }
+        pointer operator->() const { return &Store->Get(*It); }
+        TIterator& operator++() { ++It; return *this; }
+        TIterator operator++(int) { TIterator prev = *this; ++It; return prev; }
+        bool operator==(const TIterator& other) const { return It == other.It; }
+        bool operator!=(const TIterator& other) const { return It != other.It; }
+
+    private:
+        const TDocumentStore* Store;
+        TDocIds::const_iterator It;
+    };
+
+    TDocumentRange(const TDocumentStore& store, const TDocIds& ids)
+        : Store(&store)
+        , Ids(&ids)
+    {
+    }
+
+    TIterator begin() const { return TIterator(Store, Ids->cbegin()); }
+    TIterator end() const { return TIterator(Store, Ids->cend()); }
+    std::size_t size() const { return Ids->size(); }
+    bool empty() const { return Ids->empty(); }
+    const TDBDocument& front() const { return Store->Get(Ids->front()); }
+    const TDBDocument& operator[](const std::size_t i) const { return Store->Get((*Ids)[i]); }
+
+private:
+    const TDocumentStore* Store;
+    const TDocIds* Ids;
+};
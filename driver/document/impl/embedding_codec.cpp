@@ -0,0 +1,224 @@
+#include "embedding_codec.h"
+
+#include "../../utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+std::uint16_t FloatToHalf(const float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    const std::uint16_t sign = (bits >> 16) & 0x8000;
+    const std::uint32_t exponent = (bits >> 23) & 0xff;
+    std::uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent == 0xff) {
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    }
+
+    const int halfExponent = static_cast<int>(exponent) - 127 + 15;
+    if (halfExponent >= 0x1f) {
+        return sign | 0x7c00;
+    }
+    if (halfExponent <= 0) {
+        if (halfExponent < -10) {
+            return sign;
+        }
+        mantissa |= 0x800000;
+        const int shift = 14 - halfExponent;
+        std::uint32_t half = mantissa >> shift;
+        const std::uint32_t rest = mantissa & ((1u << shift) - 1);
+        const std::uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) {
+            ++half;
+        }
+        return sign | half;
+    }
+
+    std::uint32_t half = (static_cast<std::uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+    const std::uint32_t rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        ++half;
+    }
+    return sign | half;
+}
+
+float HalfToFloat(const std::uint16_t half) {
+    const std::uint32_t sign = static_cast<std::uint32_t>(half & 0x8000) << 16;
+    std::uint32_t exponent = (half >> 10) & 0x1f;
+    std::uint32_t mantissa = half & 0x3ff;
+
+    std::uint32_t bits;
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else if (exponent) {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    } else if (mantissa) {
+        exponent = 127 - 15 + 1;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    } else {
+        bits = sign;
+    }
+
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Reverses the bytes of every value on big-endian hosts, blobs are always little-endian
+template <typename T>
+void SwapLittleEndian(char* data, const std::size_t size) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    for (std::size_t i = 0; i < size; i += sizeof(T)) {
+        std::reverse(data + i, data + i + sizeof(T));
+    }
+#else
+    UNUSED(data);
+    UNUSED(size);
+#endif
+}
+
+template <typename T>
+std::string ToBytes(const std::vector<T>& values) {
+    std::string bytes(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+    SwapLittleEndian<T>(bytes.data(), bytes.size());
+    return bytes;
+}
+
+template <typename T>
+bool FromBytes(const std::string& bytes, std::vector<T>* values) {
+    if (bytes.size() % sizeof(T) != 0) {
+        return false;
+    }
+    values->resize(bytes.size() / sizeof(T));
+    char* data = reinterpret_cast<char*>(values->data());
+    std::memcpy(data, bytes.data(), bytes.size());
+    SwapLittleEndian<T>(data, bytes.size());
+    return true;
+}
+
+}  // namespace
+
+void EncodeEmbedding(const std::vector<float>& embedding,
+                     const postly::EEmbeddingEncoding encoding,
+                     postly::TEmbeddingProto* proto) {
+    proto->set_encoding(encoding);
+    switch (encoding) {
+        case postly::EE_FLOAT16: {
+            std::vector<std::uint16_t> values(embedding.size());
+            std::transform(embedding.begin(), embedding.end(), values.begin(), FloatToHalf);
+            proto->set_packed_value(ToBytes(values));
+            break;
+        }
+        case postly::EE_INT8:
+            EncodeEmbedding(QuantizeEmbedding(embedding), proto);
+            break;
+        default:
+            proto->set_encoding(postly::EE_FLOAT32);
+            proto->set_packed_value(ToBytes(embedding));
+            break;
+    }
+}
+
+void EncodeEmbedding(const TQuantizedEmbedding& embedding,
+                     postly::TEmbeddingProto* proto) {
+    proto->set_encoding(postly::EE_INT8);
+    proto->set_scale(embedding.Scale);
+    proto->set_packed_value(ToBytes(embedding.Values));
+}
+
+bool DecodeEmbedding(const postly::TEmbeddingProto& proto, std::vector<float>* embedding) {
+    if (!proto.has_packed_value()) {
+        embedding->assign(proto.value().cbegin(), proto.value().cend());
+        return true;
+    }
+
+    switch (proto.encoding()) {
+        case postly::EE_FLOAT16: {
+            std::vector<std::uint16_t> values;
+            if (!FromBytes(proto.packed_value(), &values)) {
+                return false;
+            }
+            embedding->resize(values.size());
+            std::transform(values.begin(), values.end(), embedding->begin(), HalfToFloat);
+            return true;
+        }
+        case postly::EE_INT8: {
+            std::vector<std::int8_t> values;
+            if (!FromBytes(proto.packed_value(), &values)) {
+                return false;
+            }
+            const float scale = proto.scale();
+            embedding->resize(values.size());
+            std::transform(values.begin(), values.end(), embedding->begin(), [scale](const std::int8_t value) {
+                return static_cast<float>(value) * scale;
+            });
+            return true;
+        }
+        default:
+            return FromBytes(proto.packed_value(), embedding);
+    }
+}
+
+TQuantizedEmbedding QuantizeEmbedding(const std::vector<float>& embedding) {
+    float maxAbs = 0.0f;
+    for (const float value : embedding) {
+        maxAbs = std::max(maxAbs, std::abs(value));
+    }
+
+    TQuantizedEmbedding quantized;
+    quantized.Scale = maxAbs > 0.0f ? maxAbs / 127.0f : 1.0f;
+    quantized.Values.resize(embedding.size());
+    std::transform(embedding.begin(), embedding.end(), quantized.Values.begin(),
+        [scale = quantized.Scale](const float value) {
+            return static_cast<std::int8_t>(std::clamp(std::lround(value / scale), -127l, 127l));
+        });
+    return quantized;
+}
+
+void DequantizeEmbedding(const TQuantizedEmbedding& embedding, float* out) {
+    const float scale = embedding.Scale;
+    std::transform(embedding.Values.begin(), embedding.Values.end(), out, [scale](const std::int8_t value) {
+        return static_cast<float>(value) * scale;
+    });
+}
+
+std::int32_t DotProduct(const std::int8_t* lhs, const std::int8_t* rhs, const std::size_t size) {
+    std::size_t i = 0;
+    std::int32_t result = 0;
+#ifdef __SSE2__
+    // Bytes are sign extended to 16 bits, pairs of products are summed into 32 bits
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sums = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        const __m128i lhsBytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + i));
+        const __m128i rhsBytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + i));
+        const __m128i lhsSigns = _mm_cmpgt_epi8(zero, lhsBytes);
+        const __m128i rhsSigns = _mm_cmpgt_epi8(zero, rhsBytes);
+        sums = _mm_add_epi32(sums, _mm_madd_epi16(
+            _mm_unpacklo_epi8(lhsBytes, lhsSigns), _mm_unpacklo_epi8(rhsBytes, rhsSigns)));
+        sums = _mm_add_epi32(sums, _mm_madd_epi16(
+            _mm_unpackhi_epi8(lhsBytes, lhsSigns), _mm_unpackhi_epi8(rhsBytes, rhsSigns)));
+    }
+    alignas(16) std::int32_t lanes[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(lanes), sums);
+    result = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+    for (; i < size; ++i) {
+        result += static_cast<std::int32_t>(lhs[i]) * static_cast<std::int32_t>(rhs[i]);
+    }
+    return result;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "driver/document.pb.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Per-vector scaled int8 embedding, the i-th value is Values[i] * Scale
+struct TQuantizedEmbedding {
+    std::vector<std::int8_t> Values;
+    float Scale = 1.0f;
+};
+
+// Embeddings are stored as one little-endian blob, float16 and int8 values are
+// restored with the per-vector scale. Blobs of a wrong size are not decoded
+void EncodeEmbedding(
+    const std::vector<float>& embedding,
+    const postly::EEmbeddingEncoding encoding,
+    postly::TEmbeddingProto* proto);
+
+void EncodeEmbedding(
+    const TQuantizedEmbedding& embedding,
+    postly::TEmbeddingProto* proto);
+
+bool DecodeEmbedding(const postly::TEmbeddingProto& proto, std::vector<float>* embedding);
+
+TQuantizedEmbedding QuantizeEmbedding(const std::vector<float>& embedding);
+void DequantizeEmbedding(const TQuantizedEmbedding& embedding, float* out);
+
+// Exact while size * 127^2 fits into int32
+std::int32_t DotProduct(const std::int8_t* lhs, const std::int8_t* rhs, const std::size_t size);
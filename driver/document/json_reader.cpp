@@ -0,0 +1,483 @@
+#include "json_reader.h"
+
+#include "document.h"
+#include "../utils.h"
+
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <optional>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Position of the first quote or backslash starting from pos, size if there is none
+std::size_t FindQuoteOrEscape(const char* data, std::size_t pos, const std::size_t size) {
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i escape = _mm_set1_epi8('\\');
+    for (; pos + 16 <= size; pos += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        const int mask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, escape)));
+        if (mask) {
+            return pos + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; pos < size; ++pos) {
+        if (data[pos] == '"' || data[pos] == '\\') {
+            return pos;
+        }
+    }
+    return size;
+}
+
+void AppendUtf8(const std::uint32_t codePoint, std::string* out) {
+    if (codePoint < 0x80) {
+        out->push_back(static_cast<char>(codePoint));
+    } else if (codePoint < 0x800) {
+        out->push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+        out->push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+    } else if (codePoint < 0x10000) {
+        out->push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+        out->push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+        out->push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+    } else {
+        out->push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+        out->push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+        out->push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+        out->push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+    }
+}
+
+bool IsScalarEnd(const char c) {
+    return c == ',' || c == '}' || c == ']' || c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+bool IsDigit(const char c) {
+    return c >= '0' && c <= '9';
+}
+
+// -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+bool IsJsonNumber(std::string_view value) {
+    std::size_t pos = 0;
+    const auto skipDigits = [&value, &pos] {
+        const std::size_t begin = pos;
+        while (pos < value.size() && IsDigit(value[pos])) {
+            ++pos;
+        }
+        return pos > begin;
+    };
+
+    if (pos < value.size() && value[pos] == '-') {
+        ++pos;
+    }
+    if (pos < value.size() && value[pos] == '0') {
+        ++pos;
+    } else if (!skipDigits()) {
+        return false;
+    }
+    if (pos < value.size() && value[pos] == '.') {
+        ++pos;
+        if (!skipDigits()) {
+            return false;
+        }
+    }
+    if (pos < value.size() && (value[pos] == 'e' || value[pos] == 'E')) {
+        ++pos;
+        if (pos < value.size() && (value[pos] == '+' || value[pos] == '-')) {
+            ++pos;
+        }
+        if (!skipDigits()) {
+            return false;
+        }
+    }
+    return pos == value.size();
+}
+
+class TJsonReader {
+public:
+    explicit TJsonReader(std::string_view input)
+        : Input(input)
+    {}
+
+    bool AtEnd() {
+        SkipSpaces();
+        return Pos == Input.size();
+    }
+
+    bool Peek(const char expected) {
+        SkipSpaces();
+        return Pos < Input.size() && Input[Pos] == expected;
+    }
+
+    // Consumes the next significant character if it is the expected one
+    bool Consume(const char expected) {
+        if (Peek(expected)) {
+            ++Pos;
+            return true;
+        }
+        return false;
+    }
+
+    // Strings without escapes are views into the input, others are decoded into the buffer
+    bool ReadString(std::string_view* value, std::string* decoded);
+
+    bool ReadString(std::string* value) {
+        std::string_view view;
+        if (!ReadString(&view, value)) {
+            return false;
+        }
+        if (view.data() != value->data()) {
+            value->assign(view.data(), view.size());
+        }
+        return true;
+    }
+
+    bool ReadStrings(std::vector<std::string>* values);
+    bool ReadUnsigned(std::uint64_t* value);
+    bool ReadLanguage(std::optional<postly::ELanguage>* language);
+    bool SkipValue(std::string_view* raw, std::size_t depth = 0);
+
+private:
+    void SkipSpaces() {
+        while (Pos < Input.size() &&
+               (Input[Pos] == ' ' || Input[Pos] == '\t' || Input[Pos] == '\r' || Input[Pos] == '\n')) {
+            ++Pos;
+        }
+    }
+
+    bool ReadEscape(std::string* out);
+    bool ReadHex(std::uint32_t* value);
+    bool SkipString();
+    bool ReadScalar(std::string_view* raw);
+
+private:
+    // Deeper values are rejected instead of exhausting the stack
+    static constexpr std::size_t MAX_DEPTH = 256;
+
+    const std::string_view Input;
+    std::size_t Pos = 0;
+};
+
+bool TJsonReader::ReadString(std::string_view* value, std::string* decoded) {
+    if (!Consume('"')) {
+        return false;
+    }
+    const std::size_t begin = Pos;
+    std::size_t end = FindQuoteOrEscape(Input.data(), Pos, Input.size());
+    if (end == Input.size()) {
+        return false;
+    }
+    if (Input[end] == '"') {
+        *value = Input.substr(begin, end - begin);
+        Pos = end + 1;
+        return true;
+    }
+
+    decoded->assign(Input.data() + begin, end - begin);
+    Pos = end;
+    while (Pos < Input.size() && Input[Pos] == '\\') {
+        if (!ReadEscape(decoded)) {
+            return false;
+        }
+        end = FindQuoteOrEscape(Input.data(), Pos, Input.size());
+        decoded->append(Input.data() + Pos, end - Pos);
+        Pos = end;
+    }
+    if (Pos == Input.size()) {
+        return false;
+    }
+    ++Pos;
+    *value = *decoded;
+    return true;
+}
+
+bool TJsonReader::ReadEscape(std::string* out) {
+    if (Pos + 1 >= Input.size()) {
+        return false;
+    }
+    const char escaped = Input[Pos + 1];
+    Pos += 2;
+    switch (escaped) {
+        case '"': out->push_back('"'); return true;
+        case '\\': out->push_back('\\'); return true;
+        case '/': out->push_back('/'); return true;
+        case 'b': out->push_back('\b'); return true;
+        case 'f': out->push_back('\f'); return true;
+        case 'n': out->push_back('\n'); return true;
+        case 'r': out->push_back('\r'); return true;
+        case 't': out->push_back('\t'); return true;
+        case 'u': break;
+        default: return false;
+    }
+
+    std::uint32_t codePoint = 0;
+    if (!ReadHex(&codePoint) || (codePoint >= 0xDC00 && codePoint <= 0xDFFF)) {
+        return false;
+    }
+    if (codePoint >= 0xD800 && codePoint <= 0xDBFF) {
+        std::uint32_t low = 0;
+        if (Input.substr(Pos, 2) != "\\u") {
+            return false;
+        }
+        Pos += 2;
+        if (!ReadHex(&low) || low < 0xDC00 || low > 0xDFFF) {
+            return false;
+        }
+        codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+    }
+    AppendUtf8(codePoint, out);
+    return true;
+}
+
+bool TJsonReader::ReadHex(std::uint32_t* value) {
+    if (Pos + 4 > Input.size()) {
+        return false;
+    }
+    const auto [end, error] = std::from_chars(Input.data() + Pos, Input.data() + Pos + 4, *value, 16);
+    if (error != std::errc() || end != Input.data() + Pos + 4) {
+        return false;
+    }
+    Pos += 4;
+    return true;
+}
+
+bool TJsonReader::ReadStrings(std::vector<std::string>* values) {
+    values->clear();
+    if (!Consume('[')) {
+        return false;
+    }
+    if (Consume(']')) {
+        return true;
+    }
+    do {
+        if (!ReadString(&values->emplace_back())) {
+            return false;
+        }
+    } while (Consume(','));
+    return Consume(']');
+}
+
+bool TJsonReader::ReadUnsigned(std::uint64_t* value) {
+    std::string_view raw;
+    if (!ReadScalar(&raw)) {
+        return false;
+    }
+    const auto [end, error] = std::from_chars(raw.data(), raw.data() + raw.size(), *value);
+    if (error == std::errc() && end == raw.data() + raw.size()) {
+        return true;
+    }
+
+    // Fractions and exponents are truncated, the same way a json library converts them.
+    // Values of 2^64 and more do not fit, the cast would be undefined
+    static constexpr double UNSIGNED_LIMIT = 18446744073709551616.0;
+    const std::string number(raw);
+    char* numberEnd = nullptr;
+    const double parsed = std::strtod(number.c_str(), &numberEnd);
+    if (numberEnd != number.c_str() + number.size() || !(parsed >= 0.0 && parsed < UNSIGNED_LIMIT)) {
+        return false;
+    }
+    *value = static_cast<std::uint64_t>(parsed);
+    return true;
+}
+
+bool TJsonReader::ReadLanguage(std::optional<postly::ELanguage>* language) {
+    std::string_view raw;
+    if (Peek('n')) {
+        if (!ReadScalar(&raw) || raw != "null") {
+            return false;
+        }
+        language->reset();
+        return true;
+    }
+    std::string decoded;
+    if (!ReadString(&raw, &decoded)) {
+        return false;
+    }
+    *language = FromString<postly::ELanguage>(std::string(raw));
+    return true;
+}
+
+bool TJsonReader::SkipString() {
+    ++Pos;
+    while (true) {
+        Pos = FindQuoteOrEscape(Input.data(), Pos, Input.size());
+        if (Pos == Input.size()) {
+            return false;
+        }
+        if (Input[Pos] == '"') {
+            ++Pos;
+            return true;
+        }
+        if (Pos + 1 == Input.size()) {
+            return false;
+        }
+        const char escaped = Input[Pos + 1];
+        Pos += 2;
+        if (escaped == 'u') {
+            std::uint32_t codePoint = 0;
+            if (!ReadHex(&codePoint)) {
+                return false;
+            }
+        } else if (std::string_view("\"\\/bfnrt").find(escaped) == std::string_view::npos) {
+            return false;
+        }
+    }
+}
+
+bool TJsonReader::ReadScalar(std::string_view* raw) {
+    SkipSpaces();
+    const std::size_t begin = Pos;
+    while (Pos < Input.size() && !IsScalarEnd(Input[Pos])) {
+        ++Pos;
+    }
+    *raw = Input.substr(begin, Pos - begin);
+    return *raw == "true" || *raw == "false" || *raw == "null" || IsJsonNumber(*raw);
+}
+
+bool TJsonReader::SkipValue(std::string_view* raw, const std::size_t depth) {
+    SkipSpaces();
+    if (Pos == Input.size() || depth > MAX_DEPTH) {
+        return false;
+    }
+    const std::size_t begin = Pos;
+    const char first = Input[Pos];
+    std::string_view nested;
+    if (first == '"') {
+        if (!SkipString()) {
+            return false;
+        }
+    } else if (first == '{') {
+        ++Pos;
+        if (!Consume('}')) {
+            do {
+                if (!Peek('"') || !SkipString() || !Consume(':') || !SkipValue(&nested, depth + 1)) {
+                    return false;
+                }
+            } while (Consume(','));
+            if (!Consume('}')) {
+                return false;
+            }
+        }
+    } else if (first == '[') {
+        ++Pos;
+        if (!Consume(']')) {
+            do {
+                if (!SkipValue(&nested, depth + 1)) {
+                    return false;
+                }
+            } while (Consume(','));
+            if (!Consume(']')) {
+                return false;
+            }
+        }
+    } else if (!ReadScalar(raw)) {
+        return false;
+    }
+    *raw = Input.substr(begin, Pos - begin);
+    return true;
+}
+
+}  // namespace
+
+bool ReadJsonDocument(std::string_view json, TDocument* document, const TJsonFieldCallback& onUnknownField) {
+    TJsonReader reader(json);
+    if (!reader.Consume('{')) {
+        return false;
+    }
+
+    bool hasUrl = false;
+    bool hasTitle = false;
+    bool hasText = false;
+    std::string decodedKey;
+    if (!reader.Consume('}')) {
+        do {
+            std::string_view key;
+            if (!reader.ReadString(&key, &decodedKey) || !reader.Consume(':')) {
+                return false;
+            }
+
+            bool ok = true;
+            if (key == "url") {
+                ok = hasUrl = reader.ReadString(&document->Url);
+            } else if (key == "title") {
+                ok = hasTitle = reader.ReadString(&document->Title);
+            } else if (key == "text") {
+                ok = hasText = reader.ReadString(&document->Text);
+            } else if (key == "site_name") {
+                ok = reader.ReadString(&document->SiteName);
+            } else if (key == "description") {
+                ok = reader.ReadString(&document->Description);
+            } else if (key == "file_name") {
+                ok = reader.ReadString(&document->Filename);
+            } else if (key == "timestamp") {
+                ok = reader.ReadUnsigned(&document->FetchTime);
+            } else if (key == "language") {
+                ok = reader.ReadLanguage(&document->Language);
+            } else if (key == "out_links") {
+                ok = reader.ReadStrings(&document->OutLinks);
+            } else {
+                std::string_view raw;
+                ok = reader.SkipValue(&raw);
+                if (ok && onUnknownField) {
+                    onUnknownField(key, raw);
+                }
+            }
+            if (!ok) {
+                return false;
+            }
+        } while (reader.Consume(','));
+        if (!reader.Consume('}')) {
+            return false;
+        }
+    }
+
+    return reader.AtEnd() && hasUrl && hasTitle && hasText;
+}
+
+bool ReadJsonStringField(std::string_view json, std::string_view key, std::string* value) {
+    TJsonReader reader(json);
+    if (!reader.Consume('{') || reader.Consume('}')) {
+        return false;
+    }
+
+    std::string decodedKey;
+    do {
+        std::string_view currentKey;
+        if (!reader.ReadString(&currentKey, &decodedKey) || !reader.Consume(':')) {
+            return false;
+        }
+        if (currentKey == key) {
+            return reader.ReadString(value);
+        }
+        std::string_view raw;
+        if (!reader.SkipValue(&raw)) {
+            return false;
+        }
+    } while (reader.Consume(','));
+    return false;
+}
+
+bool SplitJsonArray(std::string_view json, std::vector<std::string_view>* items) {
+    TJsonReader reader(json);
+    if (!reader.Consume('[')) {
+        return false;
+    }
+    if (reader.Consume(']')) {
+        return reader.AtEnd();
+    }
+    do {
+        std::string_view item;
+        if (!reader.SkipValue(&item)) {
+            return false;
+        }
+        items->push_back(item);
+    } while (reader.Consume(','));
+    return reader.Consume(']') && reader.AtEnd();
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <functional>
+#include <string_view>
+#include <vector>
+
+struct TDocument;
+
+using TJsonFieldCallback = std::function<void(std::string_view key, std::string_view rawValue)>;
+
+// Reads a json object straight into the document without building a tree.
+// url, title and text are required, fields unknown to TDocument are validated and
+// passed to the callback with their raw json text
+bool ReadJsonDocument(
+    std::string_view json,
+    TDocument* document,
+    const TJsonFieldCallback& onUnknownField = {});
+
+// Reads one top level string field without looking at the values after it
+bool ReadJsonStringField(std::string_view json, std::string_view key, std::string* value);
+
+// Raw json text of every element of a top level array, the views point into the input
+bool SplitJsonArray(std::string_view json, std::vector<std::string_view>* items);
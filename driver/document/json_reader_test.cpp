@@ -0,0 +1,152 @@
+// Checks of the in-place json reader: escapes, surrogates, nesting and malformed input.
+// Usage: json_reader_test, the exit code is the number of failed checks
+
+#include "document.h"
+#include "json_reader.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+int Failures = 0;
+
+#define CHECK(CONDITION)                                                    \
+    do {                                                                    \
+        if (!(CONDITION)) {                                                 \
+            std::cerr << __LINE__ << ": check failed: " #CONDITION << '\n'; \
+            ++Failures;                                                     \
+        }                                                                   \
+    } while (false)
+
+std::string MakeDocument(const std::string& extraFields) {
+    return R"({"url": "https://example.com/a", "title": "Title", "text": "Text")" + extraFields + "}";
+}
+
+bool Read(const std::string& json, TDocument* document = nullptr) {
+    TDocument scratch;
+    return ReadJsonDocument(json, document ? document : &scratch);
+}
+
+void TestFields() {
+    TDocument document;
+    CHECK(Read(MakeDocument(R"(, "site_name": "Site", "file_name": "a.html", "timestamp": 1600000000,
+        "language": "en", "out_links": ["x", "y"])"), &document));
+    CHECK(document.Url == "https://example.com/a");
+    CHECK(document.Title == "Title");
+    CHECK(document.Text == "Text");
+    CHECK(document.SiteName == "Site");
+    CHECK(document.Filename == "a.html");
+    CHECK(document.FetchTime == 1600000000);
+    CHECK(document.Language == postly::NL_EN);
+    CHECK((document.OutLinks == std::vector<std::string>{"x", "y"}));
+
+    CHECK(!Read(R"({"url": "u", "title": "t"})"));
+    CHECK(Read(MakeDocument(R"(, "language": null)"), &document));
+    CHECK(!document.Language.has_value());
+}
+
+void TestEscapes() {
+    TDocument document;
+    CHECK(Read(R"({"url": "u", "title": "a\"b\\c\/d\b\f\n\r\t", "text": "\u0041\u00e9\u044f"})", &document));
+    CHECK(document.Title == "a\"b\\c/d\b\f\n\r\t");
+    CHECK(document.Text == "A\xC3\xA9\xD1\x8F");
+
+    CHECK(!Read(R"({"url": "u", "title": "\q", "text": ""})"));
+    CHECK(!Read(R"({"url": "u", "title": "\u12", "text": ""})"));
+    CHECK(!Read(R"({"url": "u", "title": "\u12G4", "text": ""})"));
+    CHECK(!Read(R"({"url": "u", "title": "unterminated, "text": ""})"));
+    CHECK(!Read(MakeDocument(R"(, "extra": "\x")")));
+}
+
+void TestSurrogates() {
+    TDocument document;
+    CHECK(Read(R"({"url": "u", "title": "\ud83d\ude00", "text": "\ud834\udd1e"})", &document));
+    CHECK(document.Title == "\xF0\x9F\x98\x80");
+    CHECK(document.Text == "\xF0\x9D\x84\x9E");
+
+    CHECK(!Read(R"({"url": "u", "title": "\ud83d", "text": ""})"));
+    CHECK(!Read(R"({"url": "u", "title": "\ud83dx", "text": ""})"));
+    CHECK(!Read(R"({"url": "u", "title": "\ud83dA", "text": ""})"));
+    CHECK(!Read(R"({"url": "u", "title": "\ude00", "text": ""})"));
+}
+
+void TestNesting() {
+    std::string rawExtra;
+    TDocument document;
+    const std::string nested = R"({"a": [1, {"b": "]}"}, [], {}], "c": null})";
+    CHECK(ReadJsonDocument(MakeDocument(R"(, "extra": )" + nested), &document,
+        [&rawExtra](const std::string_view key, const std::string_view value) {
+            if (key == "extra") {
+                rawExtra = value;
+            }
+        }));
+    CHECK(rawExtra == nested);
+
+    CHECK(!Read(MakeDocument(R"(, "extra": [1, 2)")));
+    CHECK(!Read(MakeDocument(R"(, "extra": [1 2])")));
+    CHECK(!Read(MakeDocument(R"(, "extra": {"a" 1})")));
+    CHECK(!Read(MakeDocument(R"(, "extra": {1: 2})")));
+    CHECK(!Read(MakeDocument(R"(, "extra": [tru])")));
+    CHECK(!Read(MakeDocument(", \"extra\": " + std::string(1000, '[') + std::string(1000, ']'))));
+}
+
+void TestScalars() {
+    CHECK(Read(MakeDocument(R"(, "a": true, "b": false, "c": null, "d": -1.5e+3, "e": 0)")));
+    for (const char* value : {"tru", "nul", "True", "01", "1.", ".5", "1e", "-", "+1", "0x10", "1.5.2"}) {
+        CHECK(!Read(MakeDocument(std::string(R"(, "extra": )") + value)));
+    }
+
+    TDocument document;
+    CHECK(Read(MakeDocument(R"(, "timestamp": 1.6e9)"), &document));
+    CHECK(document.FetchTime == 1600000000);
+    CHECK(Read(MakeDocument(R"(, "timestamp": 18446744073709551615)"), &document));
+    CHECK(document.FetchTime == 18446744073709551615ULL);
+    CHECK(!Read(MakeDocument(R"(, "timestamp": 18446744073709551616)")));
+    CHECK(!Read(MakeDocument(R"(, "timestamp": 1e30)")));
+    CHECK(!Read(MakeDocument(R"(, "timestamp": -1)")));
+    CHECK(!Read(MakeDocument(R"(, "timestamp": "1")")));
+}
+
+void TestMalformed() {
+    for (const char* json : {"", "[]", "{", "{\"url\"}", "{\"url\": \"u\",}", "{,}", "null"}) {
+        CHECK(!Read(json));
+    }
+    CHECK(!Read(MakeDocument("") + " trailing"));
+    CHECK(!Read(MakeDocument(R"(, "url" "u")")));
+}
+
+void TestArrays() {
+    std::vector<std::string_view> items;
+    CHECK(SplitJsonArray(R"( [ {"a": "]"}, 1, "x" ] )", &items));
+    CHECK(items.size() == 3);
+    CHECK(items.size() == 3 && items[0] == R"({"a": "]"})" && items[1] == "1" && items[2] == "\"x\"");
+
+    items.clear();
+    CHECK(SplitJsonArray("[]", &items) && items.empty());
+    CHECK(!SplitJsonArray("[1,]", &items));
+    CHECK(!SplitJsonArray("[1] 2", &items));
+
+    std::string name;
+    CHECK(ReadJsonStringField(R"({"x": [1, {"file_name": "inner"}], "file_name": "outer"})", "file_name", &name));
+    CHECK(name == "outer");
+    CHECK(!ReadJsonStringField(R"({"file_name": 1})", "file_name", &name));
+    CHECK(!ReadJsonStringField(R"({"x": 1})", "file_name", &name));
+}
+
+}  // namespace
+
+int main() {
+    TestFields();
+    TestEscapes();
+    TestSurrogates();
+    TestNesting();
+    TestScalars();
+    TestMalformed();
+    TestArrays();
+    if (!Failures) {
+        std::cerr << "OK\n";
+    }
+    return Failures;
+}
@@ -0,0 +1,34 @@
+#include "tokenized_text.h"
+
+#include <utility>
+
+TTokenizedText::TTokenizedText(const std::vector<std::string>& titleTokens,
+                               const std::vector<std::string>& textTokens)
+    : TitleSize(titleTokens.size())
+{
+    std::size_t length = 0;
+    for (const std::vector<std::string>* tokens : {&titleTokens, &textTokens}) {
+        for (const std::string& token : *tokens) {
+            length += token.size() + 1;
+        }
+    }
+    Joined.reserve(length);
+
+    // Offsets are collected first, the buffer must not move once views point into it
+    std::vector<std::pair<std::size_t, std::size_t>> offsets;
+    offsets.reserve(titleTokens.size() + textTokens.size());
+    for (const std::vector<std::string>* tokens : {&titleTokens, &textTokens}) {
+        for (const std::string& token : *tokens) {
+            if (!Joined.empty()) {
+                Joined.push_back(' ');
+            }
+            offsets.emplace_back(Joined.size(), token.size());
+            Joined.append(token);
+        }
+    }
+
+    Tokens.reserve(offsets.size());
+    for (const auto& [offset, size] : offsets) {
+        Tokens.push_back(std::string_view(Joined).substr(offset, size));
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct TTokenSpan {
+    const std::string_view* Begin = nullptr;
+    const std::string_view* End = nullptr;
+
+    const std::string_view* begin() const { return Begin; }
+    const std::string_view* end() const { return End; }
+    std::size_t size() const { return End - Begin; }
+    bool empty() const { return Begin == End; }
+};
+
+// Title and text of a document tokenized once, tokens are views into a single
+// space separated buffer shared by the detectors and the embedders
+class TTokenizedText {
+public:
+    TTokenizedText(
+        const std::vector<std::string>& titleTokens,
+        const std::vector<std::string>& textTokens);
+
+    TTokenizedText(const TTokenizedText&) = delete;
+    TTokenizedText& operator=(const TTokenizedText&) = delete;
+
+    TTokenSpan GetTitle() const { return {Tokens.data(), Tokens.data() + TitleSize}; }
+    TTokenSpan GetText() const { return {Tokens.data() + TitleSize, Tokens.data() + Tokens.size()}; }
+    TTokenSpan GetAll() const { return {Tokens.data(), Tokens.data() + Tokens.size()}; }
+
+private:
+    std::string Joined;
+    std::vector<std::string_view> Tokens;
+    std::size_t TitleSize = 0;
+};
@@ -3,6 +3,8 @@
 #include "driver/config.pb.h"
 #include "driver/enum.pb.h"
 
+#include "../document/tokenized_text.h"
+
 #include <vector>
 
 class IEmbedder {
@@ -11,18 +13,17 @@ public:
 
     virtual ~IEmbedder() = default;
 
-    virtual std::vector<float> CalcEmbedding(const std::string& input) const = 0;
+    virtual std::vector<float> CalcEmbedding(const TTokenSpan& tokens) const = 0;
 
-    std::vector<float> CalcEmbedding(const std::string& title, const std::string& text) const {
-        std::string input;
+    std::vector<float> CalcEmbedding(const TTokenizedText& text) const {
         if (Field == postly::EF_ALL) {
-            input = title + " " + text;
+            return CalcEmbedding(text.GetAll());
         } else if (Field == postly::EF_TITLE) {
-            input = title;
+            return CalcEmbedding(text.GetTitle());
         } else if (Field == postly::EF_TEXT) {
-            input = text;
+            return CalcEmbedding(text.GetText());
         }
-        return CalcEmbedding(input);
+        return CalcEmbedding(TTokenSpan());
     }
 
 private:
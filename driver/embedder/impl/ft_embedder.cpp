@@ -1,81 +1,110 @@
 #include "ft_embedder.h"
+#include "../../model/model_registry.h"
 #include "../../utils.h"
 
-#include <sstream>
+#include <algorithm>
 #include <cassert>
+#include <string_view>
 
 #include <onmt/Tokenizer.h>
 
+namespace {
+
+// Adds a scaled word vector to the aggregate in a single pass over the dimension
+void Aggregate(const postly::EAggregationMode mode,
+               const float* vector,
+               const float scale,
+               const bool isFirst,
+               const std::size_t size,
+               float* aggregate) {
+    if (mode == postly::AM_AVG) {
+        #pragma omp simd
+        for (std::size_t i = 0; i < size; ++i) {
+            aggregate[i] += vector[i] * scale;
+        }
+    } else if (isFirst) {
+        #pragma omp simd
+        for (std::size_t i = 0; i < size; ++i) {
+            aggregate[i] = vector[i] * scale;
+        }
+    } else if (mode == postly::AM_MIN) {
+        #pragma omp simd
+        for (std::size_t i = 0; i < size; ++i) {
+            aggregate[i] = std::min(aggregate[i], vector[i] * scale);
+        }
+    } else {
+        #pragma omp simd
+        for (std::size_t i = 0; i < size; ++i) {
+            aggregate[i] = std::max(aggregate[i], vector[i] * scale);
+        }
+    }
+}
+
+}  // namespace
+
 TFTEmbedder::TFTEmbedder(
     const std::string& embeddingModelPath,
     const postly::EEmbedderField field,
     const postly::EAggregationMode mode,
-    const std::size_t maxWords
+    const std::size_t maxWords,
+    const std::size_t wordCacheSize
 )
     : IEmbedder(field)
     , Mode(mode)
     , MaxWords(maxWords)
 {
     assert(!embeddingModelPath.empty());
-    EmbeddingModel.loadModel(embeddingModelPath);
-    LLOG("FastText model loaded [" << embeddingModelPath << ']', ELogLevel::LL_INFO);
+    EmbeddingModel = TModelRegistry::Shared().GetFastText(embeddingModelPath);
+    WordVectors = TModelRegistry::Shared().GetWordVectors(embeddingModelPath, wordCacheSize);
 }
 
 TFTEmbedder::TFTEmbedder(const postly::TEmbedderConfig& config)
     : TFTEmbedder(config.vector_model_path(),
                   config.embedder_field(),
                   config.aggregation_mode(),
-                  config.max_words()) {}
+                  config.max_words(),
+                  config.word_cache_size()) {}
 
-std::vector<float> TFTEmbedder::CalcEmbedding(const std::string& input) const {
+std::vector<float> TFTEmbedder::CalcEmbedding(const TTokenSpan& tokens) const {
     assert(Mode != postly::AM_MATRIX);
 
-    std::istringstream input_stream(input);
-    const std::size_t size = EmbeddingModel.getDimension();
-
-    fasttext::Vector baseEmb(size);
-    fasttext::Vector avgEmb(size);
-    fasttext::Vector maxEmb(size);
-    fasttext::Vector minEmb(size);
-
+    const std::size_t size = EmbeddingModel->getDimension();
+    std::vector<float> embedding(size, 0.0f);
+    fasttext::Vector wordVector(size);
     std::string word;
-    std::size_t n_words = 0;
+    std::size_t nWords = 0;
 
-    while (input_stream >> word) {
-        if (n_words > MaxWords) {
+    for (const std::string_view token : tokens) {
+        if (nWords > MaxWords) {
             break;
         }
 
-        EmbeddingModel.getWordVector(baseEmb, word);
-        const float norm = baseEmb.norm();
-        if (norm - 0.0 < 1e-6) {
-            continue;
+        const float* vector = nullptr;
+        float scale = 1.0f;
+        if (WordVectors) {
+            if (const auto cachedIt = WordVectors->WordIds.find(token); cachedIt != WordVectors->WordIds.end()) {
+                vector = WordVectors->Vectors.data() + cachedIt->second * size;
+            }
         }
-        baseEmb.mul(1.0 / norm);
-
-        if (n_words == 0) {
-            maxEmb.addVector(baseEmb);
-            minEmb.addVector(baseEmb);
-        } else {
-            for (std::size_t i = 0; i < size; ++i) {
-                maxEmb[i] = std::max(maxEmb[i], baseEmb[i]);
-                minEmb[i] = std::min(minEmb[i], baseEmb[i]);
+        if (!vector) {
+            word.assign(token.data(), token.size());
+            EmbeddingModel->getWordVector(wordVector, word);
+            const float norm = wordVector.norm();
+            if (norm - 0.0 < 1e-6) {
+                continue;
             }
+            scale = 1.0 / norm;
+            vector = wordVector.data();
         }
-        avgEmb.addVector(baseEmb);
-
-        n_words++;
+        Aggregate(Mode, vector, scale, nWords == 0, size, embedding.data());
+        ++nWords;
     }
 
-    if (n_words > 0) {
-        avgEmb.mul(1.0 / static_cast<float>(n_words));
-    }
-
-    if (Mode == postly::AM_AVG) {
-        return std::vector<float>(avgEmb.data(), avgEmb.data() + avgEmb.size());
-    } else if (Mode == postly::AM_MIN) {
-        return std::vector<float>(minEmb.data(), minEmb.data() + minEmb.size());
-    } else {
-        return std::vector<float>(maxEmb.data(), maxEmb.data() + maxEmb.size());
+    if (nWords > 0 && Mode == postly::AM_AVG) {
+        const float scale = 1.0 / static_cast<float>(nWords);
+        for (float& value : embedding) {
+            value *= scale;
+        }
     }
+    return embedding;
 }
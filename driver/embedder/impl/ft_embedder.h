@@ -5,7 +5,10 @@
 #include <Eigen/Core>
 #include <fasttext.h>
 
+#include <memory>
+
 struct TDocument;
+struct TWordVectorCache;
 
 namespace fasttext {
 class FastText;
@@ -17,14 +20,18 @@ public:
         const std::string& vectorModelPath,
         const postly::EEmbedderField field,
         const postly::EAggregationMode mode,
-        const std::size_t maxWords);
+        const std::size_t maxWords,
+        const std::size_t wordCacheSize = 0);
 
     explicit TFTEmbedder(const postly::TEmbedderConfig& config);
 
-    std::vector<float> CalcEmbedding(const std::string& input) const override;
+    std::vector<float> CalcEmbedding(const TTokenSpan& tokens) const override;
 
 private:
     postly::EAggregationMode Mode;
-    fasttext::FastText EmbeddingModel;
+    std::shared_ptr<const fasttext::FastText> EmbeddingModel;
     std::size_t MaxWords;
+
+    // Shared with the other embedders of the model, nullptr without a word cache
+    std::shared_ptr<const TWordVectorCache> WordVectors;
 };
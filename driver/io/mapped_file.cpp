@@ -0,0 +1,67 @@
+#include "mapped_file.h"
+
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+TMappedFile::TMappedFile(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 0) {
+        close(fd);
+        return;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        IsOpened = true;
+        return;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    Data = static_cast<const char*>(data);
+    Size = st.st_size;
+    IsOpened = true;
+}
+
+TMappedFile::~TMappedFile() {
+    Unmap();
+}
+
+TMappedFile::TMappedFile(TMappedFile&& other) noexcept
+    : Data(std::exchange(other.Data, nullptr))
+    , Size(std::exchange(other.Size, 0))
+    , IsOpened(std::exchange(other.IsOpened, false))
+{
+}
+
+TMappedFile& TMappedFile::operator=(TMappedFile&& other) noexcept {
+    if (this != &other) {
+        Unmap();
+        Data = std::exchange(other.Data, nullptr);
+        Size = std::exchange(other.Size, 0);
+        IsOpened = std::exchange(other.IsOpened, false);
+    }
+    return *this;
+}
+
+void TMappedFile::Unmap() {
+    if (Data) {
+        munmap(const_cast<char*>(Data), Size);
+        Data = nullptr;
+    }
+    Size = 0;
+    IsOpened = false;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Read-only memory mapping of a whole file
+class TMappedFile {
+public:
+    // Check IsOpen, the file is not mapped if it is missing or cannot be read
+    explicit TMappedFile(const std::string& path);
+    ~TMappedFile();
+
+    TMappedFile(TMappedFile&& other) noexcept;
+    TMappedFile& operator=(TMappedFile&& other) noexcept;
+    TMappedFile(const TMappedFile&) = delete;
+    TMappedFile& operator=(const TMappedFile&) = delete;
+
+    bool IsOpen() const { return IsOpened; }
+    const char* GetData() const { return Data; }
+    std::size_t GetSize() const { return Size; }
+    std::string_view GetView() const { return std::string_view(Data, Size); }
+
+private:
+    void Unmap();
+
+private:
+    const char* Data = nullptr;
+    std::size_t Size = 0;
+    bool IsOpened = false;
+};
@@ -11,8 +11,12 @@
 #include "summarizer/summarizer.h"
 #include "utils.h"
 
+#include <chrono>
 #include <iostream>
+#include <map>
 #include <optional>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <boost/algorithm/string/predicate.hpp>
@@ -37,6 +41,73 @@ void BuildDebugInfo(nlohmann::json& object, const TWCluster& cluster) {
     }
 }
 
+// File names may be empty or repeated, so every document gets its input position as a suffix.
+// Documents keep their order by file name, which the clusterer uses to break fetch time ties
+void AssignDocumentIds(std::vector<TDBDocument>& docs) {
+    for (std::size_t i = 0; i < docs.size(); ++i) {
+        docs[i].Filename += "#" + std::to_string(i);
+    }
+}
+
+// Documents are keyed by the ids of AssignDocumentIds
+std::unordered_map<std::string, std::size_t> GetClusterLabels(const TIndex& index) {
+    std::unordered_map<std::string, std::size_t> labels;
+    std::size_t label = 0;
+    for (const auto& [_, clusters] : index.Clusters) {
+        for (const auto& cluster : clusters) {
+            for (const TDBDocument& doc : cluster.GetDocuments()) {
+                ENSURE(labels.emplace(doc.Filename, label).second, "Document id is not unique: " << doc.Filename);
+            }
+            ++label;
+        }
+    }
+    return labels;
+}
+
+// Adjusted Rand index and pairwise agreement of two clusterings of the same documents
+nlohmann::json CompareClusterings(const TIndex& expected, const TIndex& actual) {
+    const auto expectedLabels = GetClusterLabels(expected);
+    const auto actualLabels = GetClusterLabels(actual);
+
+    std::map<std::pair<std::size_t, std::size_t>, std::size_t> contingency;
+    std::unordered_map<std::size_t, std::size_t> expectedSizes;
+    std::unordered_map<std::size_t, std::size_t> actualSizes;
+    std::size_t nDocs = 0;
+    for (const auto& [id, expectedLabel] : expectedLabels) {
+        const auto it = actualLabels.find(id);
+        if (it == actualLabels.end()) {
+            continue;
+        }
+        ++contingency[{expectedLabel, it->second}];
+        ++expectedSizes[expectedLabel];
+        ++actualSizes[it->second];
+        ++nDocs;
+    }
+
+    const auto countPairs = [](const double size) { return size * (size - 1.0) / 2.0; };
+    double commonPairs = 0.0;
+    for (const auto& [_, size] : contingency) {
+        commonPairs += countPairs(size);
+    }
+    double expectedPairs = 0.0;
+    for (const auto& [_, size] : expectedSizes) {
+        expectedPairs += countPairs(size);
+    }
+    double actualPairs = 0.0;
+    for (const auto& [_, size] : actualSizes) {
+        actualPairs += countPairs(size);
+    }
+
+    const double randomPairs = nDocs > 1 ? expectedPairs * actualPairs / countPairs(nDocs) : 0.0;
+    const double maxPairs = (expectedPairs + actualPairs) / 2.0;
+    return {
+        {"documents", nDocs},
+        {"ari", maxPairs > randomPairs ? (commonPairs - randomPairs) / (maxPairs - randomPairs) : 1.0},
+        {"pair_recall", expectedPairs > 0.0 ? commonPairs / expectedPairs : 1.0},
+        {"pair_precision", actualPairs > 0.0 ? commonPairs / actualPairs : 1.0}
+    };
+}
+
 int RunServer(const std::string& configPath,
               const std::string& port) {
     TServer server(configPath);
@@ -94,6 +165,15 @@ int main(int argc, char** argv) {
     const bool saveNotNews = vm["save_not_news"].as<bool>();
     const bool debugMode = vm["debug_mode"].as<bool>();
 
+    // Streams annotated documents as json lines, without clustering
+    if (mode == "annotations") {
+        annotator.ProcessAll(files, inputFormat, [](TDBDocument&& doc) {
+            std::cout << doc.ToJson().dump() << "\n";
+        });
+        std::cout.flush();
+        return 0;
+    }
+
     std::vector<TDBDocument> dbDocs = annotator.ProcessAll(files, inputFormat);
 
     if (mode == "languages") {
@@ -144,6 +224,26 @@ int main(int argc, char** argv) {
         return 0;
     }
 
+    if (mode == "quantization") {
+        // Clusters with float and with int8 embeddings, the float clustering is the reference
+        AssignDocumentIds(dbDocs);
+        std::vector<TDBDocument> quantizedDocs = dbDocs;
+        for (TDBDocument& doc : quantizedDocs) {
+            doc.QuantizeEmbeddings();
+        }
+        const auto start = std::chrono::steady_clock::now();
+        const TIndex floatIndex = clusterer.Cluster(std::move(dbDocs));
+        const auto floatFinish = std::chrono::steady_clock::now();
+        const TIndex quantizedIndex = clusterer.Cluster(std::move(quantizedDocs));
+        const auto quantizedFinish = std::chrono::steady_clock::now();
+
+        nlohmann::json outputJson = CompareClusterings(floatIndex, quantizedIndex);
+        outputJson["float_seconds"] = std::chrono::duration<double>(floatFinish - start).count();
+        outputJson["quantized_seconds"] = std::chrono::duration<double>(quantizedFinish - floatFinish).count();
+        std::cout << outputJson.dump(4) << std::endl;
+        return 0;
+    }
+
     TIndex clusteringIndex = clusterer.Cluster(std::move(dbDocs));
 
     if (mode == "threads") {
@@ -0,0 +1,90 @@
+#include "model_registry.h"
+
+#include "../utils.h"
+
+#include <algorithm>
+
+#include <boost/filesystem.hpp>
+#include <fasttext.h>
+
+namespace {
+
+std::string GetModelKey(const std::string& path) {
+    boost::system::error_code error;
+    const boost::filesystem::path canonical = boost::filesystem::canonical(path, error);
+    return error ? path : canonical.string();
+}
+
+std::shared_ptr<TWordVectorCache> BuildWordVectorCache(const fasttext::FastText& model, const std::size_t size) {
+    // Vocabulary words are sorted by frequency, the first ones cover most of the tokens
+    const std::shared_ptr<const fasttext::Dictionary> dictionary = model.getDictionary();
+    const std::size_t nWords = std::min<std::size_t>(size, dictionary->nwords());
+    const std::size_t dimension = model.getDimension();
+
+    auto cache = std::make_shared<TWordVectorCache>();
+    cache->RequestedSize = size;
+    cache->Words.reserve(nWords);
+    cache->Vectors.reserve(nWords * dimension);
+    fasttext::Vector wordVector(dimension);
+    for (std::size_t id = 0; id < nWords; ++id) {
+        std::string word = dictionary->getWord(id);
+        model.getWordVector(wordVector, word);
+        const float norm = wordVector.norm();
+        if (norm - 0.0 < 1e-6) {
+            continue;
+        }
+        wordVector.mul(1.0 / norm);
+        cache->Vectors.insert(cache->Vectors.end(), wordVector.data(), wordVector.data() + dimension);
+        cache->Words.push_back(std::move(word));
+    }
+
+    cache->WordIds.reserve(cache->Words.size());
+    for (std::size_t i = 0; i < cache->Words.size(); ++i) {
+        cache->WordIds.emplace(cache->Words[i], i);
+    }
+    return cache;
+}
+
+}  // namespace
+
+TModelRegistry& TModelRegistry::Shared() {
+    static TModelRegistry registry;
+    return registry;
+}
+
+std::shared_ptr<const fasttext::FastText> TModelRegistry::GetFastText(const std::string& path) {
+    const std::string key = GetModelKey(path);
+    // Loading under the lock keeps concurrent requests of one file from loading it twice
+    std::lock_guard<std::mutex> lock(Mutex);
+    std::weak_ptr<const fasttext::FastText>& cached = FastTextModels[key];
+    if (std::shared_ptr<const fasttext::FastText> model = cached.lock()) {
+        LLOG("FastText model shared [" << path << ']', ELogLevel::LL_INFO);
+        return model;
+    }
+
+    auto model = std::make_shared<fasttext::FastText>();
+    model->loadModel(path);
+    LLOG("FastText model loaded [" << path << ']', ELogLevel::LL_INFO);
+    cached = model;
+    return model;
+}
+
+std::shared_ptr<const TWordVectorCache> TModelRegistry::GetWordVectors(const std::string& path, const std::size_t size) {
+    if (!size) {
+        return nullptr;
+    }
+    const std::shared_ptr<const fasttext::FastText> model = GetFastText(path);
+    const std::string key = GetModelKey(path);
+    std::lock_guard<std::mutex> lock(Mutex);
+    std::weak_ptr<const TWordVectorCache>& cached = WordVectorCaches[key];
+    if (std::shared_ptr<const TWordVectorCache> cache = cached.lock(); cache && cache->RequestedSize >= size) {
+        LLOG("FastText word vectors shared [" << path << ']', ELogLevel::LL_INFO);
+        return cache;
+    }
+
+    // A larger cache replaces the smaller one for new embedders, lookups give the same vectors
+    std::shared_ptr<const TWordVectorCache> cache = BuildWordVectorCache(*model, size);
+    LLOG("FastText word vectors cached [" << path << "]: " << cache->Words.size(), ELogLevel::LL_INFO);
+    cached = cache;
+    return cache;
+}
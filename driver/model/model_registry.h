@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace fasttext {
+class FastText;
+}  // namespace fasttext
+
+// Normalized vectors of the most frequent vocabulary words of a FastText model
+struct TWordVectorCache {
+    // Number of vocabulary words requested, words with zero vectors are skipped
+    std::size_t RequestedSize = 0;
+    std::vector<std::string> Words;
+    std::unordered_map<std::string_view, std::size_t> WordIds;
+    std::vector<float> Vectors;
+};
+
+// Loads every model file once per process, all users of the same file share one copy
+class TModelRegistry {
+public:
+    static TModelRegistry& Shared();
+
+    // Models are kept alive by their handles, a released model is loaded again on the next request
+    std::shared_ptr<const fasttext::FastText> GetFastText(const std::string& path);
+    // Shared by all embedders of the model, a cache of at least size words is reused
+    std::shared_ptr<const TWordVectorCache> GetWordVectors(const std::string& path, const std::size_t size);
+
+private:
+    std::mutex Mutex;
+    std::unordered_map<std::string, std::weak_ptr<const fasttext::FastText>> FastTextModels;
+    std::unordered_map<std::string, std::weak_ptr<const TWordVectorCache>> WordVectorCaches;
+};
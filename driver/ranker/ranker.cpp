@@ -2,6 +2,8 @@
 
 #include "../utils.h"
 
+#include <algorithm>
+
 namespace {
 
 TWeight GetClusterWeight(const TCluster& cluster,
@@ -29,6 +31,10 @@ TWeight GetClusterWeight(const TCluster& cluster,
 
 TRanker::TRanker(const std::string& configPath) {
     ::ParseConfig(configPath, Config);
+    std::sort(Config.mutable_view_periods()->begin(), Config.mutable_view_periods()->end());
+    Config.mutable_view_periods()->erase(
+        std::unique(Config.mutable_view_periods()->begin(), Config.mutable_view_periods()->end()),
+        Config.mutable_view_periods()->end());
 }
 
 std::vector<std::vector<TWCluster>> TRanker::Rank(TClusters::const_iterator begin,
@@ -67,3 +73,27 @@ std::vector<std::vector<TWCluster>> TRanker::Rank(TClusters::const_iterator begi
 
     return output;
 }
+
+TRankedViews TRanker::BuildViews(const TClusters& clusters,
+                                 const std::uint64_t iterTimestamp,
+                                 const std::uint64_t maxTimestamp) const {
+    TRankedViews views;
+    views.reserve(Config.view_periods_size());
+    for (const std::uint64_t period : Config.view_periods()) {
+        const std::uint64_t fromTimestamp = maxTimestamp > period ? maxTimestamp - period : 0;
+        const auto begin = std::lower_bound(clusters.cbegin(), clusters.cend(), fromTimestamp);
+
+        TRankedView view;
+        view.Period = period;
+        view.Clusters.resize(postly::ECategory_ARRAYSIZE);
+        const auto weightedClusters = Rank(begin, clusters.cend(), iterTimestamp, period);
+        for (std::size_t category = 0; category < weightedClusters.size(); ++category) {
+            view.Clusters[category].reserve(weightedClusters[category].size());
+            for (const TWCluster& cluster : weightedClusters[category]) {
+                view.Clusters[category].push_back(&cluster.Cluster.get() - clusters.data());
+            }
+        }
+        views.push_back(std::move(view));
+    }
+    return views;
+}
@@ -29,6 +29,15 @@ struct TWCluster {
     }
 };
 
+// Clusters of one language ranked for a fixed period, stored as indices into
+// the language clusters, one list per category
+struct TRankedView {
+    std::uint64_t Period = 0;
+    std::vector<std::vector<std::size_t>> Clusters;
+};
+
+using TRankedViews = std::vector<TRankedView>;
+
 class TRanker {
 public:
     TRanker(const std::string& configPath);
@@ -39,6 +48,12 @@ public:
         const std::uint64_t iterTimestamp,
         const std::uint64_t window) const;
 
+    // Views for every configured period, sorted by period
+    TRankedViews BuildViews(
+        const TClusters& clusters,
+        const std::uint64_t iterTimestamp,
+        const std::uint64_t maxTimestamp) const;
+
 private:
     postly::TRankerConfig Config;
 };
@@ -7,10 +7,10 @@
 #include "../clustering/clusterer.h"
 #include "../controller/controller.h"
 #include "../clustering/server/index.h"
+#include "../clustering/server/snapshot.h"
+#include "../storage/storage.h"
 #include "../utils.h"
 
-#include <rocksdb/db.h>
-
 #include <iostream>
 #include <sys/resource.h>
 
@@ -45,20 +45,6 @@ void CheckIO(const postly::TServerConfig& config) {
     }
 }
 
-std::unique_ptr<rocksdb::DB> CreateDB(const postly::TServerConfig& config) {
-    rocksdb::Options options;
-    options.IncreaseParallelism();
-    options.OptimizeLevelStyleCompaction();
-    options.create_if_missing = !config.db_fail_if_missing();
-    options.max_open_files = config.db_max_open_files();
-
-    rocksdb::DB* db;
-    const rocksdb::Status s = rocksdb::DB::Open(options, config.db_path(), &db);
-    ENSURE(s.ok(), "Failed to create database: " << s.getState());
-
-    return std::unique_ptr<rocksdb::DB>(db);
-}
-
 void InitServer(const postly::TServerConfig& config, const std::uint16_t port) {
     drogon::app()
         .setLogLevel(trantor::Logger::kTrace)
@@ -82,11 +68,14 @@ int TServer::Run(const std::uint16_t port) {
     LLOG("Parsed server config", ELogLevel::LL_INFO);
 
     LLOG("Creating database", ELogLevel::LL_DEBUG);
-    std::unique_ptr<rocksdb::DB> db = CreateDB(Config);
+    std::unique_ptr<TStorage> storage = std::make_unique<TStorage>(Config);
 
     LLOG("Creating annotator", ELogLevel::LL_DEBUG);
     std::vector<std::string> languages = {"ru", "en"};
     std::unique_ptr<TAnnotator> annotator = std::make_unique<TAnnotator>(Config.annotator_config_path(), languages);
+    std::unique_ptr<TThreadPool> annotatorPool = std::make_unique<TThreadPool>(
+        Config.annotator_threads() ? Config.annotator_threads() : std::thread::hardware_concurrency(),
+        Config.annotator_queue_size());
 
     LLOG("Creating clusterer", ELogLevel::LL_DEBUG);
     std::unique_ptr<TClusterer> clusterer = std::make_unique<TClusterer>(Config.clusterer_config_path());
@@ -96,8 +85,23 @@ int TServer::Run(const std::uint16_t port) {
 
     LLOG("Creating ranker", ELogLevel::LL_DEBUG);
     std::unique_ptr<TRanker> ranker = std::make_unique<TRanker>(Config.ranker_config_path());
+    std::unique_ptr<TRanker> indexRanker = std::make_unique<TRanker>(Config.ranker_config_path());
+
+    std::unique_ptr<TChangeLog> changeLog;
+    if (Config.incremental_index()) {
+        LLOG("Incremental index enabled", ELogLevel::LL_DEBUG);
+        changeLog = std::make_unique<TChangeLog>();
+    }
 
-    TServerIndex serverIndex(std::move(clusterer), std::move(summarizer), db.get());
+    TServerIndex serverIndex(
+        std::move(clusterer),
+        std::move(summarizer),
+        std::move(indexRanker),
+        storage.get(),
+        changeLog.get(),
+        Config.reclustering_window(),
+        Config.index_window(),
+        Config.quantize_embeddings());
 
     LLOG("Launching server", ELogLevel::LL_DEBUG);
     InitServer(Config, port);
@@ -106,21 +110,48 @@ int TServer::Run(const std::uint16_t port) {
     drogon::app().registerController(controllerPtr);
 
     TAtomic<TIndex> index;
-    auto initContoller = [&, annotator=std::move(annotator)]() mutable {
-        drogon::DrClassMap::getSingleInstance<TController>()->Init(&index, db.get(), std::move(annotator), std::move(ranker));
+    std::unique_ptr<TResponseCache> responseCache;
+    if (Config.response_cache_size()) {
+        responseCache = std::make_unique<TResponseCache>(Config.response_cache_size(), Config.response_cache_gzip());
+    }
+    auto initContoller = [&,
+                          annotator=std::move(annotator),
+                          annotatorPool=std::move(annotatorPool),
+                          responseCache=std::move(responseCache)]() mutable {
+        drogon::DrClassMap::getSingleInstance<TController>()->Init(
+            &index, storage.get(), std::move(annotator), std::move(ranker), changeLog.get(),
+            Config.embedding_encoding(), std::move(annotatorPool), std::move(responseCache));
     };
 
-    std::thread clusteringThread([&, sleep_ms=Config.clusterer_sleep()]() {
-        bool firstRun = true;
+    // The last snapshot serves requests until the first fresh build is ready
+    const std::string& snapshotPath = Config.index_snapshot_path();
+    bool initialized = false;
+    if (!snapshotPath.empty()) {
+        if (std::shared_ptr<TIndex> snapshot = LoadIndexSnapshot(snapshotPath)) {
+            LLOG("Loaded index snapshot: " << snapshotPath, ELogLevel::LL_INFO);
+            serverIndex.BuildRankedViews(*snapshot);
+            index.Set(std::move(snapshot));
+            initContoller();
+            initialized = true;
+        }
+    }
+
+    std::thread clusteringThread([&, sleep_ms=Config.clusterer_sleep(), firstRun=!initialized]() mutable {
+        std::shared_ptr<TIndex> savedIndex;
         while (true) {
-            TIndex newIndex = serverIndex.Build();
-            index.Set(std::make_shared<TIndex>(std::move(newIndex)));
+            std::shared_ptr<TIndex> newIndex = serverIndex.Build();
+            index.Set(newIndex);
 
             if (firstRun) {
                 initContoller();
                 firstRun = false;
             }
 
+            if (!snapshotPath.empty() && newIndex != savedIndex) {
+                SaveIndexSnapshot(*newIndex, snapshotPath);
+                savedIndex = std::move(newIndex);
+            }
+
             std::this_thread::sleep_for(std::chrono::milliseconds(sleep_ms));
         }
     });
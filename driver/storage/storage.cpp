@@ -0,0 +1,507 @@
+#include "storage.h"
+
+#include "../utils.h"
+
+#include <rocksdb/write_batch.h>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+#include <algorithm>
+#include <optional>
+
+namespace {
+
+static const std::string META_FAMILY = "meta";
+static const std::string EMBEDDINGS_FAMILY = "embeddings";
+static const std::string BODIES_FAMILY = "bodies";
+static const std::string TIMELINE_FAMILY = "timeline";
+
+constexpr std::size_t TIMESTAMP_SIZE = sizeof(std::uint64_t);
+constexpr std::size_t TIMELINE_BACKFILL_BATCH_SIZE = 10000;
+
+using google::protobuf::internal::WireFormatLite;
+
+// Reads top level varint fields, everything else is skipped without parsing
+template <typename TCallback>
+bool ReadVarints(const rocksdb::Slice& value, TCallback&& callback) {
+    google::protobuf::io::CodedInputStream input(
+        reinterpret_cast<const std::uint8_t*>(value.data()), static_cast<int>(value.size()));
+    while (const std::uint32_t tag = input.ReadTag()) {
+        if (WireFormatLite::GetTagWireType(tag) == WireFormatLite::WIRETYPE_VARINT) {
+            std::uint64_t varint = 0;
+            if (!input.ReadVarint64(&varint)) {
+                return false;
+            }
+            callback(WireFormatLite::GetTagFieldNumber(tag), varint);
+        } else if (!WireFormatLite::SkipField(&input, tag)) {
+            return false;
+        }
+    }
+    return input.ConsumedEntireMessage();
+}
+
+std::optional<std::uint64_t> ReadDocumentExpireTime(const rocksdb::Slice& value) {
+    std::optional<std::uint64_t> fetchTime;
+    std::uint64_t ttl = postly::TDocumentProto::default_instance().ttl();
+    const bool success = ReadVarints(value, [&](const int field, const std::uint64_t varint) {
+        if (field == postly::TDocumentProto::kFetchTimeFieldNumber) {
+            fetchTime = varint;
+        } else if (field == postly::TDocumentProto::kTtlFieldNumber) {
+            ttl = varint;
+        }
+    });
+    if (!success || !fetchTime) {
+        return std::nullopt;
+    }
+    return *fetchTime + ttl;
+}
+
+std::optional<std::uint64_t> ReadFetchTime(const rocksdb::Slice& value) {
+    std::optional<std::uint64_t> fetchTime;
+    const bool success = ReadVarints(value, [&](const int field, const std::uint64_t varint) {
+        if (field == postly::TDocumentProto::kFetchTimeFieldNumber) {
+            fetchTime = varint;
+        }
+    });
+    return success ? fetchTime : std::nullopt;
+}
+
+template <int ExpireTimeField>
+std::optional<std::uint64_t> ReadExpireTime(const rocksdb::Slice& value) {
+    std::optional<std::uint64_t> expireTime;
+    const bool success = ReadVarints(value, [&](const int field, const std::uint64_t varint) {
+        if (field == ExpireTimeField) {
+            expireTime = varint;
+        }
+    });
+    return success ? expireTime : std::nullopt;
+}
+
+// Big-endian, so that the bytewise order of timeline keys is the time order
+void AppendTimestamp(const std::uint64_t timestamp, std::string* buffer) {
+    for (std::size_t i = TIMESTAMP_SIZE; i > 0; --i) {
+        buffer->push_back(static_cast<char>((timestamp >> (8 * (i - 1))) & 0xFF));
+    }
+}
+
+std::uint64_t ReadTimestamp(const rocksdb::Slice& slice) {
+    std::uint64_t timestamp = 0;
+    for (std::size_t i = 0; i < TIMESTAMP_SIZE; ++i) {
+        timestamp = (timestamp << 8) | static_cast<std::uint8_t>(slice.data()[i]);
+    }
+    return timestamp;
+}
+
+std::string MakeTimelineKey(const std::uint64_t fetchTime, const rocksdb::Slice& key) {
+    std::string timelineKey;
+    timelineKey.reserve(TIMESTAMP_SIZE + key.size());
+    AppendTimestamp(fetchTime, &timelineKey);
+    timelineKey.append(key.data(), key.size());
+    return timelineKey;
+}
+
+std::string MakeTimelineValue(const std::uint64_t expireTime) {
+    std::string value;
+    AppendTimestamp(expireTime, &value);
+    return value;
+}
+
+std::optional<std::uint64_t> ReadTimelineExpireTime(const rocksdb::Slice& value) {
+    if (value.size() != TIMESTAMP_SIZE) {
+        return std::nullopt;
+    }
+    return ReadTimestamp(value);
+}
+
+class TExpiryFilter : public rocksdb::CompactionFilter {
+public:
+    using TExpireTimeReader = std::optional<std::uint64_t> (*)(const rocksdb::Slice&);
+
+    TExpiryFilter(const std::atomic<std::uint64_t>& watermark, TExpireTimeReader reader)
+        : Watermark(watermark)
+        , Reader(reader)
+    {
+    }
+
+    bool Filter(int /* level */,
+                const rocksdb::Slice& /* key */,
+                const rocksdb::Slice& value,
+                std::string* /* newValue */,
+                bool* /* valueChanged */) const override {
+        const std::uint64_t watermark = Watermark.load(std::memory_order_relaxed);
+        if (!watermark) {
+            return false;
+        }
+        const std::optional<std::uint64_t> expireTime = Reader(value);
+        return expireTime && watermark > *expireTime;
+    }
+
+    const char* Name() const override {
+        return "TExpiryFilter";
+    }
+
+private:
+    const std::atomic<std::uint64_t>& Watermark;
+    const TExpireTimeReader Reader;
+};
+
+bool ParseDocument(const rocksdb::Slice& key,
+                   const rocksdb::Slice& value,
+                   const rocksdb::Slice* embeddings,
+                   const std::uint64_t watermark,
+                   TDBDocument* doc) {
+    postly::TDocumentProto proto;
+    if (!proto.ParseFromArray(value.data(), value.size())) {
+        LLOG("Bad document in db: " << key.ToString(), ELogLevel::LL_DEBUG);
+        return false;
+    }
+    if (watermark > proto.fetch_time() + proto.ttl()) {
+        // Expired, but not compacted yet
+        return false;
+    }
+    if (embeddings) {
+        postly::TDocumentEmbeddingsProto embeddingsProto;
+        if (!embeddingsProto.ParseFromArray(embeddings->data(), embeddings->size())) {
+            LLOG("Bad embeddings in db: " << key.ToString(), ELogLevel::LL_DEBUG);
+            return false;
+        }
+        proto.mutable_embeddings()->Swap(embeddingsProto.mutable_embeddings());
+    }
+    if (!TDBDocument::FromProto(proto, doc)) {
+        LLOG("Bad embeddings in db: " << key.ToString(), ELogLevel::LL_DEBUG);
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+TStorage::TStorage(const postly::TServerConfig& config) {
+    rocksdb::Options options;
+    options.IncreaseParallelism();
+    options.OptimizeLevelStyleCompaction();
+    options.create_if_missing = !config.db_fail_if_missing();
+    options.create_missing_column_families = true;
+    options.max_open_files = config.db_max_open_files();
+    // Concurrent writers are grouped into one WAL write, pipelining lets the next group start early
+    options.enable_pipelined_write = true;
+    options.periodic_compaction_seconds = config.db_periodic_compaction_seconds();
+
+    const auto makeOptions = [this, &options](TExpiryFilter::TExpireTimeReader reader) {
+        Filters.push_back(std::make_unique<TExpiryFilter>(Watermark, reader));
+        rocksdb::ColumnFamilyOptions familyOptions(options);
+        familyOptions.compaction_filter = Filters.back().get();
+        return familyOptions;
+    };
+    const std::vector<rocksdb::ColumnFamilyDescriptor> families = {
+        {rocksdb::kDefaultColumnFamilyName, makeOptions(ReadDocumentExpireTime)},
+        {META_FAMILY, makeOptions(ReadDocumentExpireTime)},
+        {EMBEDDINGS_FAMILY, makeOptions(ReadExpireTime<postly::TDocumentEmbeddingsProto::kExpireTimeFieldNumber>)},
+        {BODIES_FAMILY, makeOptions(ReadExpireTime<postly::TDocumentBodyProto::kExpireTimeFieldNumber>)},
+        {TIMELINE_FAMILY, makeOptions(ReadTimelineExpireTime)},
+    };
+
+    std::vector<std::string> existingFamilies;
+    rocksdb::DB::ListColumnFamilies(options, config.db_path(), &existingFamilies);
+    const bool hasTimeline = std::find(
+        existingFamilies.begin(), existingFamilies.end(), TIMELINE_FAMILY) != existingFamilies.end();
+
+    rocksdb::DB* db;
+    const rocksdb::Status s = rocksdb::DB::Open(options, config.db_path(), families, &Handles, &db);
+    ENSURE(s.ok(), "Failed to create database: " << s.getState());
+    DB.reset(db);
+
+    Legacy = Handles[0];
+    Meta = Handles[1];
+    Embeddings = Handles[2];
+    Bodies = Handles[3];
+    Timeline = Handles[4];
+
+    if (!hasTimeline) {
+        BackfillTimeline();
+    }
+}
+
+void TStorage::BackfillTimeline() {
+    std::size_t count = 0;
+    for (rocksdb::ColumnFamilyHandle* family : {Legacy, Meta}) {
+        rocksdb::WriteBatch batch;
+        std::unique_ptr<rocksdb::Iterator> iter(DB->NewIterator(rocksdb::ReadOptions(true, true), family));
+        for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+            const std::optional<std::uint64_t> fetchTime = ReadFetchTime(iter->value());
+            const std::optional<std::uint64_t> expireTime = ReadDocumentExpireTime(iter->value());
+            if (!fetchTime || !expireTime) {
+                continue;
+            }
+            batch.Put(Timeline, MakeTimelineKey(*fetchTime, iter->key()), MakeTimelineValue(*expireTime));
+            if (batch.Count() >= TIMELINE_BACKFILL_BATCH_SIZE) {
+                ENSURE(DB->Write(rocksdb::WriteOptions(), &batch).ok(), "Failed to backfill timeline");
+                batch.Clear();
+            }
+            ++count;
+        }
+        ENSURE(DB->Write(rocksdb::WriteOptions(), &batch).ok(), "Failed to backfill timeline");
+    }
+    LLOG("Backfilled timeline with " << count << " docs", ELogLevel::LL_INFO);
+}
+
+std::optional<std::uint64_t> TStorage::GetFetchTime(const std::string& key) const {
+    std::string value;
+    rocksdb::Status s = DB->Get(rocksdb::ReadOptions(), Meta, key, &value);
+    if (s.IsNotFound()) {
+        s = DB->Get(rocksdb::ReadOptions(), Legacy, key, &value);
+    }
+    return s.ok() ? ReadFetchTime(value) : std::nullopt;
+}
+
+TStorage::~TStorage() {
+    for (rocksdb::ColumnFamilyHandle* handle : Handles) {
+        DB->DestroyColumnFamilyHandle(handle);
+    }
+}
+
+rocksdb::Status TStorage::Put(const std::string& key, postly::TDocumentProto&& proto) {
+    const std::uint64_t fetchTime = proto.fetch_time();
+    rocksdb::WriteBatch batch;
+    if (!AddToBatch(key, std::move(proto), &batch)) {
+        return rocksdb::Status::InvalidArgument("Failed to serialize document");
+    }
+    const rocksdb::Status s = DB->Write(rocksdb::WriteOptions(), &batch);
+    if (s.ok()) {
+        AdvanceWatermark(fetchTime);
+    }
+    return s;
+}
+
+rocksdb::Status TStorage::PutBatch(std::vector<std::pair<std::string, postly::TDocumentProto>>&& docs) {
+    std::uint64_t maxFetchTime = 0;
+    rocksdb::WriteBatch batch;
+    for (auto& [key, proto] : docs) {
+        maxFetchTime = std::max(maxFetchTime, proto.fetch_time());
+        if (!AddToBatch(key, std::move(proto), &batch)) {
+            return rocksdb::Status::InvalidArgument("Failed to serialize document " + key);
+        }
+    }
+    const rocksdb::Status s = DB->Write(rocksdb::WriteOptions(), &batch);
+    if (s.ok()) {
+        AdvanceWatermark(maxFetchTime);
+    }
+    return s;
+}
+
+bool TStorage::AddToBatch(const std::string& key, postly::TDocumentProto&& proto, rocksdb::WriteBatch* batch) const {
+    const std::uint64_t expireTime = proto.fetch_time() + proto.ttl();
+
+    postly::TDocumentEmbeddingsProto embeddings;
+    embeddings.mutable_embeddings()->Swap(proto.mutable_embeddings());
+    embeddings.set_expire_time(expireTime);
+
+    postly::TDocumentBodyProto body;
+    body.set_expire_time(expireTime);
+    body.mutable_text()->swap(*proto.mutable_text());
+    body.mutable_desc()->swap(*proto.mutable_desc());
+    body.mutable_out_links()->Swap(proto.mutable_out_links());
+    proto.clear_desc();
+
+    std::string serializedMeta;
+    std::string serializedEmbeddings;
+    std::string serializedBody;
+    if (!proto.SerializeToString(&serializedMeta)
+        || !embeddings.SerializeToString(&serializedEmbeddings)
+        || !body.SerializeToString(&serializedBody))
+    {
+        return false;
+    }
+
+    const std::optional<std::uint64_t> prevFetchTime = GetFetchTime(key);
+    if (prevFetchTime && *prevFetchTime != proto.fetch_time()) {
+        batch->Delete(Timeline, MakeTimelineKey(*prevFetchTime, key));
+    }
+    batch->Put(Timeline, MakeTimelineKey(proto.fetch_time(), key), MakeTimelineValue(expireTime));
+    batch->Delete(Legacy, key);
+    batch->Put(Meta, key, serializedMeta);
+    batch->Put(Embeddings, key, serializedEmbeddings);
+    batch->Put(Bodies, key, serializedBody);
+    return true;
+}
+
+rocksdb::Status TStorage::Delete(const std::string& key) {
+    rocksdb::WriteBatch batch;
+    if (const std::optional<std::uint64_t> fetchTime = GetFetchTime(key)) {
+        batch.Delete(Timeline, MakeTimelineKey(*fetchTime, key));
+    }
+    batch.Delete(Legacy, key);
+    batch.Delete(Meta, key);
+    batch.Delete(Embeddings, key);
+    batch.Delete(Bodies, key);
+    return DB->Write(rocksdb::WriteOptions(), &batch);
+}
+
+bool TStorage::KeyMayExist(const std::string& key) const {
+    std::string value;
+    return DB->KeyMayExist(rocksdb::ReadOptions(), Meta, key, &value)
+        || DB->KeyMayExist(rocksdb::ReadOptions(), Legacy, key, &value);
+}
+
+rocksdb::Status TStorage::GetMeta(const std::string& key, postly::TDocumentProto* proto) const {
+    std::string value;
+    rocksdb::Status s = DB->Get(rocksdb::ReadOptions(), Meta, key, &value);
+    if (s.IsNotFound()) {
+        s = DB->Get(rocksdb::ReadOptions(), Legacy, key, &value);
+    }
+    if (!s.ok()) {
+        return s;
+    }
+    if (!proto->ParseFromString(value)) {
+        return rocksdb::Status::Corruption("Bad document in db: " + key);
+    }
+    return s;
+}
+
+rocksdb::Status TStorage::GetBody(const std::string& key, postly::TDocumentBodyProto* body) const {
+    std::string value;
+    rocksdb::Status s = DB->Get(rocksdb::ReadOptions(), Bodies, key, &value);
+    if (s.ok()) {
+        return body->ParseFromString(value) ? s : rocksdb::Status::Corruption("Bad body in db: " + key);
+    }
+    if (!s.IsNotFound()) {
+        return s;
+    }
+
+    postly::TDocumentProto proto;
+    s = DB->Get(rocksdb::ReadOptions(), Legacy, key, &value);
+    if (!s.ok()) {
+        return s;
+    }
+    if (!proto.ParseFromString(value)) {
+        return rocksdb::Status::Corruption("Bad document in db: " + key);
+    }
+    body->set_text(proto.text());
+    body->set_desc(proto.desc());
+    *body->mutable_out_links() = proto.out_links();
+    return s;
+}
+
+void TStorage::AdvanceWatermark(const std::uint64_t timestamp) {
+    std::uint64_t watermark = Watermark.load(std::memory_order_relaxed);
+    while (watermark < timestamp && !Watermark.compare_exchange_weak(watermark, timestamp)) {
+    }
+}
+
+std::uint64_t TStorage::GetMaxFetchTime() const {
+    std::unique_ptr<rocksdb::Iterator> iter(DB->NewIterator(rocksdb::ReadOptions(), Timeline));
+    iter->SeekToLast();
+    return iter->Valid() && iter->key().size() >= TIMESTAMP_SIZE ? ReadTimestamp(iter->key()) : 0;
+}
+
+void TStorage::Scan(const std::uint64_t fromTimestamp, const TScanCallback& callback) {
+    rocksdb::ManagedSnapshot snapshot(DB.get());
+    const std::uint64_t watermark = GetWatermark();
+
+    // A bulk read, it should not evict the blocks of point lookups
+    rocksdb::ReadOptions ropt(true, false);
+    ropt.snapshot = snapshot.snapshot();
+
+    std::uint64_t maxFetchTime = 0;
+    const TScanCallback visit = [&](const rocksdb::Slice& key, TDBDocument&& doc) {
+        maxFetchTime = std::max(maxFetchTime, doc.FetchTime);
+        callback(key, std::move(doc));
+    };
+
+    std::unique_ptr<rocksdb::Iterator> timelineIter(DB->NewIterator(ropt, Timeline));
+    timelineIter->SeekToFirst();
+    const bool isWindowed = fromTimestamp && timelineIter->Valid()
+        && timelineIter->key().size() >= TIMESTAMP_SIZE && ReadTimestamp(timelineIter->key()) < fromTimestamp;
+    if (isWindowed) {
+        ScanTimeline(fromTimestamp, ropt, watermark, timelineIter.get(), visit);
+    } else {
+        ScanAll(ropt, watermark, visit);
+    }
+
+    AdvanceWatermark(maxFetchTime);
+}
+
+void TStorage::ScanAll(const rocksdb::ReadOptions& ropt,
+                       const std::uint64_t watermark,
+                       const TScanCallback& callback) const {
+    std::unique_ptr<rocksdb::Iterator> legacyIter(DB->NewIterator(ropt, Legacy));
+    for (legacyIter->SeekToFirst(); legacyIter->Valid(); legacyIter->Next()) {
+        if (legacyIter->value().empty()) {
+            continue;
+        }
+        TDBDocument doc;
+        if (ParseDocument(legacyIter->key(), legacyIter->value(), nullptr, watermark, &doc)) {
+            callback(legacyIter->key(), std::move(doc));
+        }
+    }
+
+    // Both families are written by the same batches, so their keys match
+    std::unique_ptr<rocksdb::Iterator> metaIter(DB->NewIterator(ropt, Meta));
+    std::unique_ptr<rocksdb::Iterator> embeddingsIter(DB->NewIterator(ropt, Embeddings));
+    embeddingsIter->SeekToFirst();
+    for (metaIter->SeekToFirst(); metaIter->Valid(); metaIter->Next()) {
+        if (!embeddingsIter->Valid() || embeddingsIter->key() != metaIter->key()) {
+            embeddingsIter->Seek(metaIter->key());
+            if (!embeddingsIter->Valid() || embeddingsIter->key() != metaIter->key()) {
+                LLOG("No embeddings in db: " << metaIter->key().ToString(), ELogLevel::LL_DEBUG);
+                continue;
+            }
+        }
+
+        const rocksdb::Slice embeddings = embeddingsIter->value();
+        TDBDocument doc;
+        if (ParseDocument(metaIter->key(), metaIter->value(), &embeddings, watermark, &doc)) {
+            callback(metaIter->key(), std::move(doc));
+        }
+        embeddingsIter->Next();
+    }
+}
+
+void TStorage::ScanTimeline(const std::uint64_t fromTimestamp,
+                            const rocksdb::ReadOptions& ropt,
+                            const std::uint64_t watermark,
+                            rocksdb::Iterator* iter,
+                            const TScanCallback& callback) const {
+    std::string meta;
+    std::string embeddings;
+    for (iter->Seek(MakeTimelineKey(fromTimestamp, rocksdb::Slice())); iter->Valid(); iter->Next()) {
+        const rocksdb::Slice timelineKey = iter->key();
+        if (timelineKey.size() < TIMESTAMP_SIZE) {
+            continue;
+        }
+        const std::optional<std::uint64_t> expireTime = ReadTimelineExpireTime(iter->value());
+        if (expireTime && watermark > *expireTime) {
+            continue;
+        }
+
+        const std::uint64_t fetchTime = ReadTimestamp(timelineKey);
+        const rocksdb::Slice key(timelineKey.data() + TIMESTAMP_SIZE, timelineKey.size() - TIMESTAMP_SIZE);
+
+        TDBDocument doc;
+        rocksdb::Status s = DB->Get(ropt, Meta, key, &meta);
+        if (s.ok()) {
+            s = DB->Get(ropt, Embeddings, key, &embeddings);
+            if (!s.ok()) {
+                LLOG("No embeddings in db: " << key.ToString(), ELogLevel::LL_DEBUG);
+                continue;
+            }
+            const rocksdb::Slice embeddingsSlice(embeddings);
+            if (!ParseDocument(key, meta, &embeddingsSlice, watermark, &doc)) {
+                continue;
+            }
+        } else if (DB->Get(ropt, Legacy, key, &meta).ok()) {
+            if (!ParseDocument(key, meta, nullptr, watermark, &doc)) {
+                continue;
+            }
+        } else {
+            continue;
+        }
+
+        // Entries left behind by concurrent rewrites of the same document
+        if (doc.FetchTime != fetchTime) {
+            continue;
+        }
+        callback(key, std::move(doc));
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "driver/config.pb.h"
+#include "driver/document.pb.h"
+
+#include "../document/impl/db_document.h"
+
+#include <rocksdb/compaction_filter.h>
+#include <rocksdb/db.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Documents are split into column families: metadata and embeddings are
+// read on every index build, bodies are read only on demand. Documents
+// written by older versions stay in the default column family as a whole.
+// The timeline family keys every document by big-endian fetch time and name,
+// so windowed builds read only recent documents, already in time order.
+// Documents expired relative to the watermark are dropped by compactions
+class TStorage {
+public:
+    using TScanCallback = std::function<void(const rocksdb::Slice& key, TDBDocument&& doc)>;
+
+    explicit TStorage(const postly::TServerConfig& config);
+    ~TStorage();
+
+    rocksdb::Status Put(const std::string& key, postly::TDocumentProto&& proto);
+    // All documents are committed atomically by one write
+    rocksdb::Status PutBatch(std::vector<std::pair<std::string, postly::TDocumentProto>>&& docs);
+    rocksdb::Status Delete(const std::string& key);
+    bool KeyMayExist(const std::string& key) const;
+
+    // Metadata with empty text fields and without embeddings
+    rocksdb::Status GetMeta(const std::string& key, postly::TDocumentProto* proto) const;
+    rocksdb::Status GetBody(const std::string& key, postly::TDocumentBodyProto* body) const;
+
+    // Visits unexpired documents fetched not earlier than fromTimestamp with metadata
+    // and embeddings as of one snapshot. A window that starts after the oldest document
+    // is read through the timeline, ordered by fetch time and key; otherwise all
+    // families are scanned sequentially in key order
+    void Scan(const std::uint64_t fromTimestamp, const TScanCallback& callback);
+    std::uint64_t GetMaxFetchTime() const;
+
+    // Latest fetch time seen, documents with fetch_time + ttl behind it are expired
+    std::uint64_t GetWatermark() const { return Watermark.load(std::memory_order_relaxed); }
+    void AdvanceWatermark(const std::uint64_t timestamp);
+
+private:
+    void BackfillTimeline();
+    void ScanAll(
+        const rocksdb::ReadOptions& ropt,
+        const std::uint64_t watermark,
+        const TScanCallback& callback) const;
+    void ScanTimeline(
+        const std::uint64_t fromTimestamp,
+        const rocksdb::ReadOptions& ropt,
+        const std::uint64_t watermark,
+        rocksdb::Iterator* iter,
+        const TScanCallback& callback) const;
+    bool AddToBatch(const std::string& key, postly::TDocumentProto&& proto, rocksdb::WriteBatch* batch) const;
+    std::optional<std::uint64_t> GetFetchTime(const std::string& key) const;
+
+private:
+    std::atomic<std::uint64_t> Watermark = 0;
+    std::vector<std::unique_ptr<rocksdb::CompactionFilter>> Filters;
+
+    std::unique_ptr<rocksdb::DB> DB;
+    std::vector<rocksdb::ColumnFamilyHandle*> Handles;
+
+    rocksdb::ColumnFamilyHandle* Legacy = nullptr;
+    rocksdb::ColumnFamilyHandle* Meta = nullptr;
+    rocksdb::ColumnFamilyHandle* Embeddings = nullptr;
+    rocksdb::ColumnFamilyHandle* Bodies = nullptr;
+    rocksdb::ColumnFamilyHandle* Timeline = nullptr;
+};
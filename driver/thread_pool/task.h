@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Move-only void() callable, small callables are stored without allocation
+class TTask {
+public:
+    TTask() = default;
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, TTask>>>
+    TTask(F&& func) {
+        using TFunc = std::decay_t<F>;
+        if constexpr (IsInline<TFunc>()) {
+            new (&Storage) TFunc(std::forward<F>(func));
+            VTable = &InlineVTable<TFunc>;
+        } else {
+            new (&Storage) TFunc*(new TFunc(std::forward<F>(func)));
+            VTable = &HeapVTable<TFunc>;
+        }
+    }
+
+    TTask(TTask&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    TTask& operator=(TTask&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    TTask(const TTask&) = delete;
+    TTask& operator=(const TTask&) = delete;
+
+    ~TTask() {
+        Reset();
+    }
+
+    void operator()() {
+        VTable->Call(&Storage);
+    }
+
+    explicit operator bool() const {
+        return VTable != nullptr;
+    }
+
+private:
+    static constexpr std::size_t INLINE_SIZE = 6 * sizeof(void*);
+
+    struct TVTable {
+        void (*Call)(void* storage);
+        void (*Move)(void* from, void* to);
+        void (*Destroy)(void* storage);
+    };
+
+    template <typename TFunc>
+    static constexpr bool IsInline() {
+        return sizeof(TFunc) <= INLINE_SIZE
+            && alignof(TFunc) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible_v<TFunc>;
+    }
+
+    template <typename TFunc>
+    static constexpr TVTable InlineVTable = {
+        [](void* storage) { (*static_cast<TFunc*>(storage))(); },
+        [](void* from, void* to) {
+            new (to) TFunc(std::move(*static_cast<TFunc*>(from)));
+            static_cast<TFunc*>(from)->~TFunc();
+        },
+        [](void* storage) { static_cast<TFunc*>(storage)->~TFunc(); },
+    };
+
+    template <typename TFunc>
+    static constexpr TVTable HeapVTable = {
+        [](void* storage) { (**static_cast<TFunc**>(storage))(); },
+        [](void* from, void* to) { new (to) TFunc*(*static_cast<TFunc**>(from)); },
+        [](void* storage) { delete *static_cast<TFunc**>(storage); },
+    };
+
+    void MoveFrom(TTask& other) {
+        VTable = other.VTable;
+        if (VTable) {
+            VTable->Move(&other.Storage, &Storage);
+            other.VTable = nullptr;
+        }
+    }
+
+    void Reset() {
+        if (VTable) {
+            VTable->Destroy(&Storage);
+            VTable = nullptr;
+        }
+    }
+
+private:
+    std::aligned_storage_t<INLINE_SIZE, alignof(std::max_align_t)> Storage;
+    const TVTable* VTable = nullptr;
+};
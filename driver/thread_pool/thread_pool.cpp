@@ -1,30 +1,125 @@
 #include "thread_pool.h"
 
-TThreadPool::TThreadPool(std::size_t threadsCount) {
+namespace {
+
+thread_local const void* CurrentPool = nullptr;
+thread_local std::size_t CurrentWorker = 0;
+
+}  // namespace
+
+TThreadPool::TThreadPool(std::size_t threadsCount, std::size_t maxQueueSize)
+    : MaxQueueSize(maxQueueSize)
+{
+    threadsCount = std::max<std::size_t>(threadsCount, 1);
+    for (std::size_t i = 0; i < threadsCount; ++i) {
+        Workers.push_back(std::make_unique<TWorker>());
+    }
     for (std::size_t i = 0; i < threadsCount; ++i) {
-        Threads.emplace_back(
-            [this] {
-                while(true) {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(Mutex);
-                        Condition.wait(lock, [this]{ return this->IsDone || !this->Tasks.empty(); });
-                        if (IsDone && Tasks.empty()) {
-                            return;
-                        }
-                        task = std::move(Tasks.front());
-                        Tasks.pop();
-                    }
-                    task();
-                }
-            }
-        );
+        Threads.emplace_back([this, i] { Work(i); });
+    }
+}
+
+TThreadPool& TThreadPool::Shared() {
+    static TThreadPool pool;
+    return pool;
+}
+
+bool TThreadPool::TryEnqueue(TTask task) {
+    if (IsDone.load() || (MaxQueueSize && Pending.load(std::memory_order_relaxed) >= MaxQueueSize)) {
+        return false;
+    }
+    Push(std::move(task));
+    return true;
+}
+
+void TThreadPool::Push(TTask&& task) {
+    // Pending is counted before the task can be popped, so it never wraps below zero.
+    // Pairs with the sleeping side in Work: either the worker sees the new task
+    // or this thread sees the worker asleep and wakes it up
+    if (CurrentPool == this) {
+        TWorker& worker = *Workers[CurrentWorker];
+        std::lock_guard<std::mutex> lock(worker.Mutex);
+        worker.Tasks.push_back(std::move(task));
+        Pending.fetch_add(1);
+    } else {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Tasks.push_back(std::move(task));
+        Pending.fetch_add(1);
+    }
+
+    if (Sleeping.load() > 0) {
+        std::lock_guard<std::mutex> lock(SleepMutex);
+        Condition.notify_one();
+    }
+}
+
+bool TThreadPool::TryPop(TTask& task) {
+    const bool isWorker = CurrentPool == this;
+    if (isWorker) {
+        TWorker& worker = *Workers[CurrentWorker];
+        std::lock_guard<std::mutex> lock(worker.Mutex);
+        if (!worker.Tasks.empty()) {
+            task = std::move(worker.Tasks.back());
+            worker.Tasks.pop_back();
+            Pending.fetch_sub(1);
+            return true;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        if (!Tasks.empty()) {
+            task = std::move(Tasks.front());
+            Tasks.pop_front();
+            Pending.fetch_sub(1);
+            return true;
+        }
+    }
+
+    const std::size_t start = isWorker ? CurrentWorker + 1 : 0;
+    for (std::size_t i = 0; i < Workers.size(); ++i) {
+        TWorker& victim = *Workers[(start + i) % Workers.size()];
+        std::unique_lock<std::mutex> lock(victim.Mutex, std::try_to_lock);
+        if (lock.owns_lock() && !victim.Tasks.empty()) {
+            task = std::move(victim.Tasks.front());
+            victim.Tasks.pop_front();
+            Pending.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TThreadPool::RunPending() {
+    TTask task;
+    if (!TryPop(task)) {
+        return false;
+    }
+    task();
+    return true;
+}
+
+void TThreadPool::Work(const std::size_t index) {
+    CurrentPool = this;
+    CurrentWorker = index;
+    while (true) {
+        if (RunPending()) {
+            continue;
+        }
+        if (IsDone.load() && !Pending.load()) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(SleepMutex);
+        Sleeping.fetch_add(1);
+        Condition.wait(lock, [this] { return IsDone.load() || Pending.load() > 0; });
+        Sleeping.fetch_sub(1);
     }
 }
 
 TThreadPool::~TThreadPool() {
     {
-        std::unique_lock<std::mutex> lock(Mutex);
+        std::lock_guard<std::mutex> lock(SleepMutex);
         IsDone = true;
     }
 
@@ -1,33 +1,72 @@
-// Based on https://github.com/progschj/ThreadPool.
+// Work-stealing pool: every worker owns a deque, tasks spawned by a worker go
+// to its own deque and idle workers steal from the others. Tasks submitted
+// from outside go through a shared FIFO queue.
 
 #pragma once
 
-#include <vector>
-#include <queue>
-#include <memory>
-#include <thread>
-#include <mutex>
+#include "task.h"
+
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
-#include <future>
+#include <deque>
+#include <exception>
 #include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 class TThreadPool {
 public:
-    TThreadPool(std::size_t threadsCount=std::thread::hardware_concurrency());
+    // Zero maxQueueSize means an unbounded queue, only TryEnqueue respects the bound
+    TThreadPool(std::size_t threadsCount=std::thread::hardware_concurrency(), std::size_t maxQueueSize=0);
+
+    // Process-wide pool with a thread per core, for batch processing
+    static TThreadPool& Shared();
 
     template<class F, class... Args>
     auto enqueue(F&& f, Args&&... args)
         -> std::future<typename std::result_of<F(Args...)>::type>;
 
+    // Returns false without running the task if the queue is full or the pool is stopped
+    bool TryEnqueue(TTask task);
+
+    // Calls func(i) for every i in [begin, end), grain indices per task. The calling
+    // thread takes part and runs other queued tasks while waiting, so nested calls are safe.
+    // The first exception stops handing out indices and is rethrown once all helpers are done
+    template<class F>
+    void ParallelFor(std::size_t begin, std::size_t end, F&& func, std::size_t grain=1);
+
+    std::size_t GetThreadsCount() const { return Threads.size(); }
+
     ~TThreadPool();
 
+private:
+    struct TWorker {
+        std::mutex Mutex;
+        std::deque<TTask> Tasks;
+    };
+
+    void Push(TTask&& task);
+    bool TryPop(TTask& task);
+    bool RunPending();
+    void Work(std::size_t index);
+
 private:
     std::vector<std::thread> Threads;
-    std::queue<std::function<void()>> Tasks;
+    std::vector<std::unique_ptr<TWorker>> Workers;
 
     std::mutex Mutex;
+    std::deque<TTask> Tasks;
+
+    std::atomic<std::size_t> Pending = 0;
+    std::atomic<std::size_t> Sleeping = 0;
+    std::mutex SleepMutex;
     std::condition_variable Condition;
-    bool IsDone = false;
+    std::atomic<bool> IsDone = false;
+    const std::size_t MaxQueueSize;
 };
 
 template<class F, class... Args>
@@ -36,23 +75,70 @@ auto TThreadPool::enqueue(F&& f, Args&&... args)
 {
     using return_type = typename std::result_of<F(Args...)>::type;
 
-    auto task = std::make_shared< std::packaged_task<return_type()> >(
+    std::packaged_task<return_type()> task(
         std::bind(std::forward<F>(f), std::forward<Args>(args)...)
     );
 
-    std::future<return_type> res = task->get_future();
+    std::future<return_type> res = task.get_future();
 
-    {
-        std::unique_lock<std::mutex> lock(Mutex);
+    if (IsDone.load()) {
+        throw std::runtime_error("enqueue on stopped TThreadPool");
+    }
+
+    Push(TTask(std::move(task)));
+    return res;
+}
 
-        if (IsDone) {
-            throw std::runtime_error("enqueue on stopped TThreadPool");
+template<class F>
+void TThreadPool::ParallelFor(std::size_t begin, std::size_t end, F&& func, std::size_t grain) {
+    if (begin >= end) {
+        return;
+    }
+    grain = std::max<std::size_t>(grain, 1);
+
+    std::atomic<std::size_t> next = begin;
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    const auto run = [&next, &func, &errorMutex, &error, end, grain] {
+        while (true) {
+            const std::size_t from = next.fetch_add(grain, std::memory_order_relaxed);
+            if (from >= end) {
+                return;
+            }
+            const std::size_t to = std::min(end, from + grain);
+            try {
+                for (std::size_t i = from; i < to; ++i) {
+                    func(i);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                next.store(end, std::memory_order_relaxed);
+                return;
+            }
         }
+    };
 
-        Tasks.emplace([task](){ (*task)(); });
+    const std::size_t chunks = (end - begin + grain - 1) / grain;
+    const std::size_t helpers = std::min(chunks, Workers.size() + 1) - 1;
+    std::atomic<std::size_t> running = helpers;
+    for (std::size_t i = 0; i < helpers; ++i) {
+        Push(TTask([&run, &running] {
+            run();
+            running.fetch_sub(1, std::memory_order_release);
+        }));
     }
 
-    Condition.notify_one();
-    return res;
+    // Helpers refer to this frame, so it is not left before they finish
+    run();
+    while (running.load(std::memory_order_acquire)) {
+        if (!RunPending()) {
+            std::this_thread::yield();
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
 }
-
@@ -0,0 +1,94 @@
+// Checks of the queue bound of TThreadPool::TryEnqueue under concurrent producers.
+// Usage: thread_pool_test, the exit code is the number of failed checks
+
+#include "thread_pool.h"
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+int Failures = 0;
+
+#define CHECK(CONDITION)                                                    \
+    do {                                                                    \
+        if (!(CONDITION)) {                                                 \
+            std::cerr << __LINE__ << ": check failed: " #CONDITION << '\n'; \
+            ++Failures;                                                     \
+        }                                                                   \
+    } while (false)
+
+// Producers keep far fewer tasks outstanding than the bound, so no call may be rejected
+void TestNoRejectionsBelowBound() {
+    const std::size_t nProducers = 4;
+    const std::size_t maxOutstanding = 4;
+    const std::size_t nCalls = 50000;
+
+    TThreadPool pool(2, 1000);
+    std::atomic<std::size_t> rejected = 0;
+    std::vector<std::thread> producers;
+    for (std::size_t i = 0; i < nProducers; ++i) {
+        producers.emplace_back([&] {
+            std::atomic<std::size_t> outstanding = 0;
+            for (std::size_t call = 0; call < nCalls; ++call) {
+                while (outstanding.load() >= maxOutstanding) {
+                    std::this_thread::yield();
+                }
+                outstanding.fetch_add(1);
+                if (!pool.TryEnqueue([&outstanding] { outstanding.fetch_sub(1); })) {
+                    outstanding.fetch_sub(1);
+                    rejected.fetch_add(1);
+                }
+            }
+            while (outstanding.load()) {
+                std::this_thread::yield();
+            }
+        });
+    }
+    for (std::thread& producer : producers) {
+        producer.join();
+    }
+    CHECK(rejected.load() == 0);
+}
+
+void TestRejectionsAboveBound() {
+    const std::size_t maxQueueSize = 8;
+    TThreadPool pool(1, maxQueueSize);
+
+    std::atomic<bool> isStarted = false;
+    std::atomic<bool> isReleased = false;
+    CHECK(pool.TryEnqueue([&] {
+        isStarted = true;
+        while (!isReleased.load()) {
+            std::this_thread::yield();
+        }
+    }));
+    while (!isStarted.load()) {
+        std::this_thread::yield();
+    }
+
+    std::atomic<std::size_t> done = 0;
+    for (std::size_t i = 0; i < maxQueueSize; ++i) {
+        CHECK(pool.TryEnqueue([&done] { done.fetch_add(1); }));
+    }
+    CHECK(!pool.TryEnqueue([&done] { done.fetch_add(1); }));
+
+    isReleased = true;
+    while (done.load() < maxQueueSize) {
+        std::this_thread::yield();
+    }
+    CHECK(pool.TryEnqueue([] {}));
+}
+
+}  // namespace
+
+int main() {
+    TestNoRejectionsBelowBound();
+    TestRejectionsAboveBound();
+    if (!Failures) {
+        std::cerr << "OK\n";
+    }
+    return Failures;
+}